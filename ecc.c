@@ -0,0 +1,291 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief ECC model for screening multi-bit error patterns
+*
+* @details Random raw error patterns (a number of bit flips anywhere in
+* an ECC codeword, check bits included) are run through a model of the
+* memory's ECC decoder and classified as corrected, detected but not
+* correctable (DUE, which the hardware reports as a machine check and
+* the application dies), or silent (undetected, or miscorrected into
+* different data). Only silent patterns are worth a trial. Two codes
+* are modelled:
+*  - SECDED: a (72,64) Hsiao code over one 64-bit word
+*  - chipkill: an SSC-DSD Reed-Solomon code over GF(2^8) with 16 data and
+*    3 check symbols, covering two 64-bit words (16 bytes); each 8-bit
+*    symbol models the bits one x4 DRAM device gives over two bursts
+* Both codes are linear, so a pattern's syndrome is the XOR of the
+* syndromes of its flipped bits. Since patterns are sparse, candidates
+* are screened in batches by a branch-free table-XOR loop, and a second
+* branch-free pass drops the syndromes that are certainly DUE (an even
+* weight SECDED syndrome, since every Hsiao column has odd weight, or a
+* chipkill syndrome with S0 or S1 zero, which no single-symbol error
+* has), so only the rest are decoded in full. It can be compiled into a
+* stand-alone self-test and benchmark using -DTESTING
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdc.h"
+
+#define ECC_BATCH 1024
+#define SECDED_BITS 72     // 64 data bits, then 8 check bits
+#define CHIPKILL_SYMBOLS 19 // 16 data symbols, then 3 check symbols
+#define CHIPKILL_BITS (CHIPKILL_SYMBOLS*8)
+
+static uint32_t secdedSyndrome[SECDED_BITS];   // H matrix column of each bit
+static int16_t secdedCorrects[256];            // bit a syndrome corrects, or -1
+static uint32_t chipkillSyndrome[CHIPKILL_BITS]; // S0 | S1<<8 | S2<<16
+static uint8_t gfExp[512], gfLog[256];
+static int eccReady = 0;
+
+/**
+* @brief Multiply in GF(2^8)
+**/
+static uint8_t gfMul(uint8_t a, uint8_t b)
+{
+   if (!a || !b)
+      return 0;
+   return gfExp[gfLog[a] + gfLog[b]];
+}
+
+/**
+* @brief Build the code tables
+**/
+void eccInit(void)
+{
+   int i, j, v, w, col = 0;
+   uint8_t bit;
+   if (eccReady)
+      return;
+   // Hsiao code: check bits get the weight-1 columns, data bits the 56
+   // weight-3 columns and then 8 of the weight-5 columns; all columns are
+   // distinct and odd, so single errors are corrected and doubles detected
+   for (w = 3; w <= 5; w += 2)
+      for (v = 1; v < 256 && col < 64; v++)
+         if (__builtin_popcount(v) == w)
+            secdedSyndrome[col++] = v;
+   for (i = 0; i < 8; i++)
+      secdedSyndrome[64+i] = 1 << i;
+   for (i = 0; i < 256; i++)
+      secdedCorrects[i] = -1;
+   for (i = 0; i < SECDED_BITS; i++)
+      secdedCorrects[secdedSyndrome[i]] = i;
+   // GF(2^8) with primitive polynomial x^8+x^4+x^3+x^2+1
+   v = 1;
+   for (i = 0; i < 255; i++) {
+      gfExp[i] = gfExp[i+255] = v;
+      gfLog[v] = i;
+      v <<= 1;
+      if (v & 0x100)
+         v ^= 0x11d;
+   }
+   // syndrome S_m of a single bit b in symbol j is b * alpha^(m*j)
+   for (i = 0; i < CHIPKILL_BITS; i++) {
+      j = i / 8;
+      bit = 1 << (i % 8);
+      chipkillSyndrome[i] = bit | (gfMul(bit, gfExp[j]) << 8) |
+                            (gfMul(bit, gfExp[(2*j) % 255]) << 16);
+   }
+   eccReady = 1;
+}
+
+/**
+* @brief Cheap xorshift generator, so screening is not bound by random()
+**/
+static uint64_t nextRandom(uint64_t *state)
+{
+   *state ^= *state >> 12;
+   *state ^= *state << 25;
+   *state ^= *state >> 27;
+   return *state * 0x2545f4914f6cdd1dUL;
+}
+
+/**
+* @brief Decode a syndrome as the modelled hardware would
+*
+* @param correctBit is set to the first codeword bit of the correction
+* @param correction is set to the correction applied from that bit
+* @return 0 if no error is seen, 1 if corrected, -1 if DUE
+**/
+static int decodeSyndrome(int model, uint32_t syndrome, int *correctBit,
+                          uint8_t *correction)
+{
+   uint8_t s0, s1, s2;
+   int j;
+   if (!syndrome)
+      return 0;
+   if (model == eccSECDED) {
+      if (secdedCorrects[syndrome] < 0)
+         return -1;
+      *correctBit = secdedCorrects[syndrome];
+      *correction = 1;
+      return 1;
+   }
+   // single symbol error e at j has S0 = e, S1 = e*a^j, S2 = e*a^2j
+   s0 = syndrome; s1 = syndrome >> 8; s2 = syndrome >> 16;
+   if (!s0 || !s1)
+      return -1;
+   j = (gfLog[s1] + 255 - gfLog[s0]) % 255;
+   if (j >= CHIPKILL_SYMBOLS || s2 != gfMul(s1, gfExp[j]))
+      return -1;
+   *correctBit = j * 8;
+   *correction = s0;
+   return 1;
+}
+
+/**
+* @brief Find a random error pattern that the ECC lets through silently
+*
+* @param model is eccSECDED or eccCHIPKILL
+* @param flips is the number of raw bit flips in a candidate pattern
+* @param maxCandidates limits how many candidates are screened
+* @param seed seeds the candidate generator
+* @param mask is set to the data corruption the application will see:
+* mask[0] for the 64-bit word (SECDED) or mask[0] and mask[1] for the
+* two words of the 16-byte block (chipkill)
+* @param stats accumulates the classification counts of every candidate
+* screened (whole batches, so the counts estimate the class fractions)
+* @return 1 if a silent pattern was found, 0 if not
+**/
+int eccScreen(int model, int flips, unsigned long maxCandidates, uint64_t seed,
+              uint64_t mask[2], EccStats *stats)
+{
+   static uint8_t pos[MAX_ECC_FLIPS][ECC_BATCH];
+   static uint32_t syndrome[ECC_BATCH];
+   static uint16_t keep[ECC_BATCH];
+   const uint32_t *table;
+   uint64_t state = seed | 1, data[2];
+   int i, k, f, g, n, nbits, found = -1, status, correctBit = 0;
+   uint8_t correction = 0;
+   eccInit();
+   if (flips < 1 || flips > MAX_ECC_FLIPS)
+      return 0;
+   table = model == eccSECDED ? secdedSyndrome : chipkillSyndrome;
+   nbits = model == eccSECDED ? SECDED_BITS : CHIPKILL_BITS;
+   while (found < 0 && stats->candidates < maxCandidates) {
+      // generate a batch of patterns of distinct bit positions
+      for (i = 0; i < ECC_BATCH; i++)
+         for (f = 0; f < flips; f++) {
+            do {
+               pos[f][i] = nextRandom(&state) % nbits;
+               for (g = 0; g < f && pos[g][i] != pos[f][i]; g++)
+                  ;
+            } while (g < f);
+         }
+      // syndromes are XORs of the single-bit syndromes
+      for (i = 0; i < ECC_BATCH; i++)
+         syndrome[i] = 0;
+      for (f = 0; f < flips; f++)
+         for (i = 0; i < ECC_BATCH; i++)
+            syndrome[i] ^= table[pos[f][i]];
+      // drop the certain DUEs, keeping the rest in order
+      n = 0;
+      if (model == eccSECDED)
+         for (i = 0; i < ECC_BATCH; i++) {
+            keep[n] = i;
+            n += !syndrome[i] || (__builtin_popcount(syndrome[i]) & 1);
+         }
+      else
+         for (i = 0; i < ECC_BATCH; i++) {
+            keep[n] = i;
+            n += !syndrome[i] || ((syndrome[i] & 0xff) && (syndrome[i] & 0xff00));
+         }
+      stats->detected += ECC_BATCH - n;
+      // classify, finding what data each remaining pattern leaves behind
+      for (k = 0; k < n; k++) {
+         i = keep[k];
+         status = decodeSyndrome(model, syndrome[i], &correctBit, &correction);
+         if (status < 0) {
+            stats->detected++;
+            continue;
+         }
+         data[0] = data[1] = 0;
+         for (f = 0; f < flips; f++)
+            if (pos[f][i] < 128 && (model == eccCHIPKILL || pos[f][i] < 64))
+               data[pos[f][i]/64] ^= 1UL << (pos[f][i] % 64);
+         if (status > 0 && correctBit < (model == eccSECDED ? 64 : 128))
+            data[correctBit/64] ^= ((uint64_t) correction) << (correctBit % 64);
+         if (!data[0] && !data[1]) {
+            stats->corrected++;
+            continue;
+         }
+         stats->silent++;
+         if (found < 0) {
+            found = i;
+            mask[0] = data[0];
+            mask[1] = data[1];
+         }
+      }
+      stats->candidates += ECC_BATCH;
+   }
+   return found >= 0;
+}
+
+#ifdef TESTING
+#include <time.h>
+int main(int argc, char **argv)
+{
+   int i, j, a, b, bad = 0, failures, correctBit;
+   uint8_t correction;
+   uint64_t mask[2];
+   EccStats stats;
+   struct timespec t0, t1;
+   double secs;
+   eccInit();
+   // every single bit error is corrected, every double detected
+   for (i = 0; i < SECDED_BITS; i++) {
+      if (decodeSyndrome(eccSECDED, secdedSyndrome[i], &correctBit, &correction) != 1 ||
+          correctBit != i)
+         bad++;
+      for (j = i+1; j < SECDED_BITS; j++)
+         if (decodeSyndrome(eccSECDED, secdedSyndrome[i] ^ secdedSyndrome[j],
+                            &correctBit, &correction) != -1)
+            bad++;
+   }
+   fprintf(stderr, "SECDED single/double bit errors: %d failures\n", bad);
+   // every single symbol error is corrected, every double detected
+   failures = bad;
+   bad = 0;
+   for (i = 0; i < CHIPKILL_SYMBOLS; i++)
+      for (a = 1; a < 256; a++) {
+         uint32_t si = 0;
+         for (j = 0; j < 8; j++)
+            if (a & (1 << j))
+               si ^= chipkillSyndrome[i*8+j];
+         if (decodeSyndrome(eccCHIPKILL, si, &correctBit, &correction) != 1 ||
+             correctBit != i*8 || correction != a)
+            bad++;
+         for (j = i+1; j < CHIPKILL_SYMBOLS; j++)
+            for (b = 1; b < 256; b += 37) {
+               uint32_t sj = 0; int k;
+               for (k = 0; k < 8; k++)
+                  if (b & (1 << k))
+                     sj ^= chipkillSyndrome[j*8+k];
+               if (decodeSyndrome(eccCHIPKILL, si ^ sj, &correctBit, &correction) != -1)
+                  bad++;
+            }
+      }
+   fprintf(stderr, "Chipkill single/double symbol errors: %d failures\n", bad);
+   failures += bad;
+   // screening throughput
+   for (i = eccSECDED; i <= eccCHIPKILL; i++)
+      for (j = 1; j <= 4; j++) {
+         memset(&stats, 0, sizeof(stats));
+         clock_gettime(CLOCK_MONOTONIC, &t0);
+         while (stats.candidates < 4000000)
+            eccScreen(i, j, 4000000, stats.candidates + 12345, mask, &stats);
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+         fprintf(stderr, "%s %d flips: %.1f M candidates/s, %lu corrected %lu detected "
+                 "%lu silent\n", i == eccSECDED ? "SECDED" : "Chipkill", j,
+                 stats.candidates / secs / 1e6, stats.corrected, stats.detected,
+                 stats.silent);
+      }
+   return failures ? 1 : 0;
+}
+#endif
@@ -8,6 +8,11 @@
 * USAGE:
 * - set environment variable SDC_DELAY to the integer # of seconds
 *   of wall-time to wait before injecting the error (default: 3 seconds)
+* - set environment variable SDC_TRIGGER to inject on an event instead of after
+*   SDC_DELAY seconds: 'MPI_Name:N' injects right before the Nth call of an MPI
+*   routine (e.g., 'MPI_Allreduce:500'; needs the library built with 'make MPI=1'),
+*   and 'point:ID:N' injects right before the Nth SDC_INJECT_POINT(ID) in the
+*   application (see sdcinject.h). Calls are counted per thread.
 * - set environment variable SDC_MPIONLY if you want to only inject an
 *   MPI process (this checks for env vars and allows you to avoid injecting 
 *   into mpirun/mpiexec)
@@ -17,25 +22,71 @@
 * - set environment variable SDC_OUTFILE to the name of the desired output
 *   file (defaults to sdcout-PID.log, where PID is the process PID for this run)
 *   Use one '%d' in the output filename if you want the PID embedded in the name.
-* - set environment variable SDC_MEMTYPE to one of the following:
+* - set environment variable SDC_MEMTYPE to one or more of the following, 
+*   separated by '|' (e.g., 'heap|stack|dso:libfoo'):
 *   -- 'all' -- any memory in the application space (and its DSO libraries) may be 
 *               injected with an error
 *   -- 'data' -- any data memory in the application space may be injected with an error
 *   -- 'code' -- any program memory in the application space may be injected with an error
+*   -- 'rodata' -- any read-only, non-program memory may be injected with an error
 *   -- 'appdata' -- any data memory in the application space, but not data memory in the
 *                   DSO libraries, may be injected with an error (excl heap and stack, bad!)
 *   -- 'heap' -- any memory in the application's heap may be injected with an error
 *   -- 'stack' -- any memory in the application's stack may be injected with an error
+*   -- 'anon' -- any data memory not backed by a file (incl heap and stack) may be
+*                injected with an error
+*   -- 'dso' -- any memory in the DSO libraries may be injected with an error
+*   -- 'dso:NAME' -- any memory in the DSO libraries whose file name contains NAME
+*                    may be injected with an error (up to 8 of these)
+*   -- 'region' -- only the memory regions the application registered with
+*                 SDC_REGISTER_REGION() (see sdcinject.h) may be injected with an error
 *   -- default is 'data'
+* - set environment variable SDC_MODE to one of the following:
+*   -- 'memory' -- inject the error into application memory (default)
+*   -- 'register' -- inject the error into the saved register state of a
+*                    randomly chosen application thread (x86_64 only)
+* - set environment variable SDC_REGTYPE to 'gpr', 'vector' or 'all' to choose
+*   which registers 'register' mode may inject (default: 'all'); vector registers
+*   are XMM, YMM or ZMM depending on what the CPU saves
+* - set environment variable SDC_SIGNAL to the offset from SIGRTMIN of the
+*   real-time signal used to deliver register errors (default: 4)
+* - set environment variable SDC_BITS to a bit number or range (e.g., '52-62')
+*   to limit which bits of the 64-bit memory word may be flipped (default: 0-63),
+*   or to 'sign', 'exponent' or 'mantissa' to flip a bit in that field of the
+*   element (the element type of a registered region; doubles otherwise)
+* - set environment variable SDC_WORDTYPE to one or more of 'double', 'float',
+*   'pointer', 'int', 'zero' and 'other', separated by '|', to only inject words
+*   that look like that type of data: candidate words are drawn as usual and
+*   rejected until one is of a requested type, guessed by classifying the words
+*   of its page (see wordtype.c). SDC_BITS fields then apply to the word's type,
+*   e.g., SDC_WORDTYPE=double SDC_BITS=exponent flips only double exponents.
+*   SDC_WORDTRIES limits the candidates drawn (default: 100000)
+* - set environment variable SDC_FLIPS to the number of bits to flip (default: 1,
+*   at most 8); without an ECC model they are distinct bits of one 64-bit word
+* - set environment variable SDC_ECC to 'secded' or 'chipkill' to model the memory's
+*   ECC: random patterns of SDC_FLIPS raw flips anywhere in the codeword (check
+*   bits included) are screened until one is found that the ECC would neither
+*   correct nor detect (a detected error is a machine-check crash, not an SDC),
+*   and only that pattern's effect on the data is injected; SDC_BITS is then
+*   ignored. 'secded' is a (72,64) Hsiao code over the 64-bit word, 'chipkill'
+*   a single-symbol-correct, double-symbol-detect code over the 16-byte block,
+*   with 8-bit symbols (default: 'none'). SDC_ECCMAX limits how many patterns
+*   are screened (default: 16777216); the screening counts are logged
+* - set environment variable SDC_STRATUM to a stratum name (as logged on the
+*   'Stratum:' line, e.g., 'data:[heap]' or 'code:/usr/lib/libc.so.6') to only
+*   inject segments of the chosen memory type in that stratum; see sdcstrata.c
+* - set environment variable SDC_PLAN to a campaign plan file (compiled from a
+*   text manifest by sdcplan, see sdcplan.c) to configure each (trial,rank)
+*   separately; SDC_TRIAL gives the trial number of this run (default: 0).
+*   With a plan, SDC_MPIONLY and SDC_MPIRANK are ignored: only processes with
+*   an entry in the plan are injected, and plan settings override the
+*   environment variables above
 * - load this library into app space using LD_PRELOAD
 * - run the application
 *
 * TODO:
-* - use env var for bit range for errors (i.e., limit to exponent?)
 * - decide on 32 or 64 bit base (effects address alignment and bit range)
 * - need some sort of process selection capability (extern random # set into env var?)
-* - allow double bit errors (ecc will correct single bit, but single models other problems too)
-* - allow OR in of different memory types
 *
 * Copyright (C) 2021 Jonathan Cook
 * All rights reserved.
@@ -54,6 +105,7 @@
 #undef __USE_GNU
 #include <pthread.h>
 #include <sys/mman.h> // for mprotect()
+#include <signal.h>
 #include "sdc.h"
 
 int sdcDebug = 0;
@@ -66,142 +118,479 @@ unsigned long totalCodeMemory = 0;
 unsigned long totalHeapMemory = 0;
 unsigned long totalStackMemory = 0;
 unsigned long totalAppDataMemory = 0;
+unsigned long totalClassMemory[NUM_MEM_CLASSES];
+char *dsoPatterns[MAX_DSO_PATTERNS];
+int numDsoPatterns = 0;
+int skipSpecialMaps = 0;
 static int myMPIRank = -1;
 static pthread_t sdcInjectorThread = 0;
 static int waitSecondsUntilInject = 3;
 static unsigned long systemPageSize = 0;
 static char logFilename[128];
 
-static enum {injectALL=1, injectDATA, injectCODE, injectAPPDATA,
-             injectHEAP, injectSTACK} injectMemoryType = injectALL;
-static char* injectMTName[] = {"Unknown", "All", "Data", "Code", "AppData",
-                               "Heap", "Stack", "Unusable"};
+static unsigned int injectMemoryClasses = MEM_DATA;
+static char injectMemoryTypeName[64] = "data";
+static InjectMode injectMode = injectMEMORY;
+static char* injectModeName[] = {"Unknown", "Memory", "Register"};
+static int injectRegisterType = REGS_GPR|REGS_VECTOR;
+static int registerSignalOffset = 4;
+static int injectBitLow = 0, injectBitHigh = 63;
+static int injectBitField = bitsRANGE;
+static char* bitFieldName[] = BIT_FIELD_NAMES;
+static char* elemTypeName[] = ELEM_TYPE_NAMES;
+static unsigned int injectWordTypes = 0;
+static char injectWordTypeName[64];
+static char* wordTypeName[] = WORD_TYPE_NAMES;
+static char* memClassName[] = MEM_CLASS_NAMES;
+static int wordMaxTries = 100000;
+#define USER_SPACE_END (1UL << 47) // end of canonical x86_64 user addresses
+static int campaignTrial = -1;
+static char injectStratum[160];
+static int regionsSkipped = 0;   // registered regions not in one readable mapping
+static int triggerEvent = -1;
+static unsigned long triggerCount = 0;
+static char triggerName[32];
+static int injectEccModel = eccNONE;
+static char* eccModelName[] = ECC_MODEL_NAMES;
+static int injectFlips = 1;
+static unsigned long eccMaxCandidates = 1UL << 24;
 
 // routines from readsmaps.c
 void dumpMemoryMap(int level);
 int readProcSmaps(int pid);
+int findStratumId(const char *stratum);
+unsigned long memoryClassSize(unsigned int classMask, int stratumId);
+unsigned long indexMemoryClasses(unsigned int classMask, int stratumId);
+MapSegment* selectIndexedSegment(unsigned long offset, unsigned long *segOffset);
+int addRegionSegments(int *skipped);
+// routines from registers.c
+int injectRegisterError(FILE *logf, int regClass, int sigNum);
+// routines from plan.c
+unsigned int parseMemoryType(const char *spec, char **patterns, int *numPatterns);
+int parseInjectMode(const char *name);
+int parseRegisterType(const char *name);
+int parseBitRange(const char *range, int *low, int *high);
+int parseBitField(const char *name);
+unsigned int parseWordType(const char *spec);
+int lookupPlanEntry(const char *filename, int trial, int rank, PlanEntry *entry);
+int parseTrigger(const char *spec, unsigned long *count);
+int parseEccModel(const char *name);
+// routines from trigger.c
+void armTrigger(int event, unsigned long count);
+void waitForTrigger(void);
+void triggerDone(void);
+// routines from wordtype.c
+int wordTypeAt(const uint64_t *ptr, uint64_t ptrLow, uint64_t ptrHigh);
+void clearWordTypeCache(void);
+// routines from ecc.c
+int eccScreen(int model, int flips, unsigned long maxCandidates, uint64_t seed,
+              uint64_t mask[2], EccStats *stats);
 
 /**
-* @brief Thread routine for injecting SDC error(s)
+* @brief Re-seed the random number generator with a 'random' seed
+**/
+static void seedRandom(void)
+{
+   unsigned int seed; int randDev;
+   randDev = open("/dev/random", O_RDONLY);
+   if (randDev != -1) {
+      read(randDev, &seed, sizeof(seed));
+      srandom(seed);
+      close(randDev);
+   } else {
+      srandom(time(0)+clock());
+   }
+}
+
+/**
+* @brief Store a value into a word on a page the application cannot write
 *
-* @param p is required pthread start-function parameter, not used
-* @return NULL always
-* @details This function is started in its own thread, and its job
-* is to simply sleep for the specified number of seconds, then
-* generate a random address (8-byte aligned) and inject a random
-* bit error. Once an error is injected, this function returns and
-* the thread dies.
+* @param injectPtr is the address of the word
+* @param value is the new value of the word
+* @param map is the (non-writable) map segment the word is in
+* @return 0 if written through /proc/self/mem, 1 if written using mprotect(),
+* -1 on failure
+* @details Writing through /proc/self/mem is allowed on read-only mappings
+* (the kernel forces the write) and leaves the mapping alone: mprotect()
+* on a single page splits the VMA, breaks up a transparent huge page and
+* shoots down the TLB of every application thread, all of which would
+* slow the application down after the injection. mprotect() is only used
+* if /proc/self/mem cannot be written (e.g., proc_mem.force_override=never).
 **/
-void* sdcInjectorStart(void *p)
+static int writeProtectedWord(uint64_t *injectPtr, uint64_t value, MapSegment *map)
+{
+   int memFd;
+   ssize_t n = -1;
+   char* pagePtr; unsigned int pagePerms;
+   memFd = open("/proc/self/mem", O_RDWR);
+   if (memFd >= 0) {
+      n = pwrite(memFd, &value, sizeof(value), (off_t) (uintptr_t) injectPtr);
+      close(memFd);
+   }
+   if (n == sizeof(value))
+      return 0;
+   // make page writeable just long enough to store the value
+   pagePtr = (char *)(((unsigned long)injectPtr) & ~(systemPageSize-1));
+   pagePerms = 0;
+   if (map->permissions & PERM_READ)
+      pagePerms |= PROT_READ;
+   if (map->permissions & PERM_EXEC)
+      pagePerms |= PROT_EXEC;
+   if (mprotect(pagePtr, systemPageSize, pagePerms | PROT_WRITE))
+      return -1;
+   *injectPtr = value;
+   mprotect(pagePtr, systemPageSize, pagePerms);
+   return 1;
+}
+
+/**
+* @brief Set the memory type to inject from a memory type string
+* @return 0 on success, -1 if the string is not valid
+**/
+static int setMemoryType(const char *spec)
+{
+   unsigned int classes;
+   char *patterns[MAX_DSO_PATTERNS];
+   int i, count = 0;
+   classes = parseMemoryType(spec, patterns, &count);
+   if (!classes || strlen(spec) >= sizeof(injectMemoryTypeName)) {
+      for (i = 0; i < count; i++)
+         free(patterns[i]);
+      return -1;
+   }
+   for (i = 0; i < numDsoPatterns; i++)
+      free(dsoPatterns[i]);
+   for (i = 0; i < count; i++)
+      dsoPatterns[i] = patterns[i];
+   numDsoPatterns = count;
+   injectMemoryClasses = classes;
+   strcpy(injectMemoryTypeName, spec);
+   return 0;
+}
+
+/**
+* @brief Set the word types to inject from a word type string
+* @return 0 on success, -1 if the string is not valid
+**/
+static int setWordType(const char *spec)
+{
+   unsigned int types;
+   types = parseWordType(spec);
+   if (!types || strlen(spec) >= sizeof(injectWordTypeName))
+      return -1;
+   injectWordTypes = types;
+   strcpy(injectWordTypeName, spec);
+   return 0;
+}
+
+/**
+* @brief Set the event trigger from a trigger string
+* @return 0 on success, -1 if the string is not valid
+**/
+static int setTrigger(const char *spec)
+{
+   int event;
+   unsigned long count;
+   event = parseTrigger(spec, &count);
+   if (event < 0 || strlen(spec) >= sizeof(triggerName))
+      return -1;
+   triggerEvent = event;
+   triggerCount = count;
+   strcpy(triggerName, spec);
+   return 0;
+}
+
+/**
+* @brief Find the bits of an element's field within the 64-bit word
+*
+* @param field is bitsSIGN, bitsEXPONENT or bitsMANTISSA
+* @param elemType is the SDC_ELEM_* type of the element; float and int32
+* elements are 32 bits, others 64, and memory that is not a registered
+* region (SDC_ELEM_BYTES) is taken to hold doubles. Integers have no
+* exponent, so 'exponent' and 'mantissa' both give their value bits.
+* @param shift is the bit position of the element in the word
+**/
+static void fieldBitRange(int field, int elemType, int shift, int *low, int *high)
+{
+   int width, expBits;
+   width = (elemType == SDC_ELEM_FLOAT || elemType == SDC_ELEM_INT32) ? 32 : 64;
+   expBits = (width == 32) ? 8 : 11;
+   if (field == bitsSIGN) {
+      *low = *high = width-1;
+   } else if (elemType == SDC_ELEM_INT32 || elemType == SDC_ELEM_INT64) {
+      *low = 0;
+      *high = width-2;
+   } else if (field == bitsEXPONENT) {
+      *low = width-1-expBits;
+      *high = width-2;
+   } else {
+      *low = 0;
+      *high = width-2-expBits;
+   }
+   *low += shift;
+   *high += shift;
+}
+
+/**
+* @brief Write the injector configuration to the top of a log entry
+**/
+static void logConfiguration(FILE *logf)
+{
+   fprintf(logf, "SDC Configuration:\nDelay %d\n", waitSecondsUntilInject);
+   if (triggerEvent >= 0)
+      fprintf(logf, "Trigger: %s\n", triggerName);
+   fprintf(logf, "MPI Rank: %d\n", myMPIRank);
+   if (campaignTrial >= 0)
+      fprintf(logf, "Trial: %d\n", campaignTrial);
+   if (injectBitField != bitsRANGE)
+      fprintf(logf, "Bit Field: %s\n", bitFieldName[injectBitField]);
+   else if (injectBitLow != 0 || injectBitHigh != 63)
+      fprintf(logf, "Bit Range: %d-%d\n", injectBitLow, injectBitHigh);
+   if (injectStratum[0])
+      fprintf(logf, "Sampling Stratum: %s\n", injectStratum);
+   if (injectMode == injectREGISTER) {
+      fprintf(logf, "Mode: %s\n", injectModeName[injectMode]);
+      return;
+   }
+   if (injectEccModel != eccNONE)
+      fprintf(logf, "ECC Model: %s\nRaw Bit Flips: %d\n",
+              eccModelName[injectEccModel], injectFlips);
+   else if (injectFlips > 1)
+      fprintf(logf, "Bit Flips: %d\n", injectFlips);
+   if (injectWordTypes)
+      fprintf(logf, "Requested Word Type: %s\n", injectWordTypeName);
+   fprintf(logf, "Memory Type: %s\n", injectMemoryTypeName);
+   if (regionsSkipped)
+      fprintf(logf, "Regions Skipped: %d (not inside one readable mapping)\n",
+              regionsSkipped);
+   fprintf(logf, "Total (Write) Memory: %ld %ld\n", totalMemory, totalWriteMemory);
+}
+
+/**
+* @brief Inject one SDC error, as configured
+*
+* @details Generates a random address (8-byte aligned) and injects a
+* random bit error (or a multi-bit error, screened through the ECC model
+* if one is set), or injects a register error, and logs it. In a
+* registered region, a random element is chosen and a named bit field
+* is that element's field; the injected word (and chipkill block) are
+* kept inside the region.
+**/
+static void injectError(void)
 {
    FILE *logf;
-   unsigned long randomSize, addressMask;
-   uintptr_t randomAddress;
-   uint64_t injectVal;
+   unsigned long randomSize, addressMask, segOffset;
+   uintptr_t randomAddress, elemAddress = 0, wordAddress, blockAddress = 0;
+   uint64_t injectMask[2];
    uint64_t *injectPtr;
-   unsigned int randomBit, seed; int randDev;
-   char* pagePtr; unsigned int pagePerms;
+   unsigned int randomBit;
+   int i, bitLow, bitHigh, bitRange, elemSize, elemType, elemShift = 0;
+   int wordType = -1, wordTries, eccModel, rejected;
+   char sep;
+   unsigned long ptrLow = 0, ptrHigh = 0;
+   int injectWords = 1, writePath = -1, stratumId = -1;
+   EccStats eccStats = {0};
    MapSegment *map;
-   if (sdcDebug>1)
-      fprintf(stderr, "In SDC thread, waiting %d seconds\n", waitSecondsUntilInject);
-   // go to sleep for awhile
-   sleep(waitSecondsUntilInject);
-   // awake, now inject a bit error
-   
+   if (injectMode == injectREGISTER) {
+      seedRandom();
+      logf = fopen(logFilename,"a");
+      if (logf) {
+         logConfiguration(logf);
+         fflush(logf);
+      }
+      injectRegisterError(logf, injectRegisterType, SIGRTMIN+registerSignalOffset);
+      if (logf)
+         fclose(logf);
+      return;
+   }
+
    // make address mask
    addressMask = (~0)^0x7; // all ones except lower three bits
    
-   // read O/S memory map for this process
+   // read O/S memory map for this process (without the special maps
+   // that fault when read, if pages are going to be classified)
+   skipSpecialMaps = injectWordTypes != 0;
    readProcSmaps(0);
+   if (injectMemoryClasses & MEM_REGION)
+      addRegionSegments(&regionsSkipped);
    if (sdcDebug > 2) 
       dumpMemoryMap(1);
-   // choose whether injecting into data (write) memory or all memory
-   if (injectMemoryType == injectDATA)
-      randomSize = totalWriteMemory;
-   else if (injectMemoryType == injectCODE)
-      randomSize = totalCodeMemory;
-   else if (injectMemoryType == injectHEAP)
-      randomSize = totalHeapMemory;
-   else if (injectMemoryType == injectSTACK)
-      randomSize = totalStackMemory;
-   else if (injectMemoryType == injectAPPDATA)
-      randomSize = totalAppDataMemory;
+   // index the segments of the chosen memory classes; stratified
+   // sampling only chooses from the segments of one stratum
+   if (injectStratum[0])
+      stratumId = findStratumId(injectStratum);
+   if (injectStratum[0] && stratumId < 0)
+      randomSize = 0;
    else
-      randomSize = totalMemory;
-   // re-seed with a 'random' seed
-   randDev = open("/dev/random", O_RDONLY);
-   if (randDev != -1) {
-      read(randDev, &seed, sizeof(seed));
-      srandom(seed);
-      close(randDev);
-   } else {
-      srandom(time(0)+clock());
+      randomSize = indexMemoryClasses(injectMemoryClasses, stratumId);
+   if (!randomSize) {
+      if (sdcDebug) fprintf(stderr, "SDC: no memory of chosen type to inject\n");
+      return;
    }
-   // choose an 8-byte aligned address (offset)
-   randomAddress = (random() % randomSize) & addressMask;
-   // choose an 8-byte bit number
-   randomBit = (random() >> 2) % 64;
-   if (sdcDebug)
-      fprintf(stderr, "SDC: Injecting error at %lx (%lx), bit %d!\n", randomAddress,
-              randomSize, randomBit);
-   // now must map chosen address (offset) onto a real address in
-   // one of the mapped sections (not ELF sections)
-   randomSize = 0;
-   map = memoryMap;
-   // find map where this address offset falls into
-   while (map && randomSize < randomAddress) {
-      if ((injectMemoryType == injectALL) ||
-          (injectMemoryType == injectDATA && map->permissions & PERM_WRITE) ||
-          (injectMemoryType == injectCODE && map->permissions & PERM_EXEC) ||
-          (injectMemoryType == injectAPPDATA && map->permissions & PERM_WRITE) ||
-          (injectMemoryType == injectSTACK && !strcmp(map->name,"[stack]")) ||
-          (injectMemoryType == injectHEAP && !strcmp(map->name,"[heap]"))) {
-         randomSize += (map->endAddress - map->beginAddress);
-         if (randomSize > randomAddress) break;
+   // re-seed with a 'random' seed
+   seedRandom();
+   // values in the span of mapped user-space memory are taken to be
+   // pointers (not up to [vsyscall], or every double would be one)
+   if (injectWordTypes)
+      for (map = memoryMap; map; map = map->next) {
+         if (map->endAddress > USER_SPACE_END)
+            continue;
+         if (!ptrLow || map->beginAddress < ptrLow)
+            ptrLow = map->beginAddress;
+         if (map->endAddress > ptrHigh)
+            ptrHigh = map->endAddress;
+      }
+   // choose a word; if word types are requested, reject candidates
+   // until one is of a requested type (classifying pages afresh, since
+   // the memory has changed since any earlier injection)
+   clearWordTypeCache();
+   for (wordTries = 1; ; wordTries++) {
+      // choose an address (offset), aligned once it is mapped; random() is only 31 bits
+      randomAddress = (((unsigned long) random()) << 31 | random()) % randomSize;
+      // now must map chosen address (offset) onto a real address in
+      // one of the mapped sections (not ELF sections)
+      map = selectIndexedSegment(randomAddress, &segOffset);
+      if (!map) {
+         if (sdcDebug) fprintf(stderr, "SDC: failed to find map for address %lx\n", randomAddress);
+         return;
+      }
+      // re-map randomAddress to a real address in this map section
+      randomAddress = map->beginAddress + segOffset;
+      injectPtr = (uint64_t *) (randomAddress & addressMask); // need to realign after map base?
+      blockAddress = randomAddress & ~0xfUL;
+      elemType = map->elementType;
+      elemShift = 0;
+      eccModel = injectEccModel;
+      rejected = 0;
+      if (map->memoryClasses & MEM_REGION) {
+         // inject the word holding a random element of the region, using
+         // an unaligned word where the aligned one is not all inside it
+         // (regions are whole elements, at least 8 bytes, see readsmaps.c)
+         elemSize = (elemType == SDC_ELEM_FLOAT || elemType == SDC_ELEM_INT32) ? 4 : 8;
+         elemAddress = map->beginAddress + segOffset - segOffset % elemSize;
+         wordAddress = elemAddress & addressMask;
+         if (wordAddress < map->beginAddress || elemAddress + elemSize > wordAddress + 8)
+            wordAddress = elemAddress;
+         if (wordAddress + 8 > map->endAddress)
+            wordAddress = map->endAddress - 8;
+         elemShift = (elemAddress - wordAddress) * 8;
+         injectPtr = (uint64_t *) wordAddress;
+         // a chipkill block must be inside the region too, so redraw if it
+         // is not, or use SECDED if the region has no whole block
+         if (eccModel == eccCHIPKILL) {
+            blockAddress = elemAddress & ~0xfUL;
+            if (((map->beginAddress + 0xf) & ~0xfUL) + 16 > map->endAddress)
+               eccModel = eccSECDED;
+            else if (blockAddress < map->beginAddress || blockAddress + 16 > map->endAddress)
+               rejected = 1;
+         }
+      }
+      if (!rejected && !injectWordTypes)
+         break;
+      if (!rejected && (map->permissions & PERM_READ)) {
+         wordType = wordTypeAt((uint64_t *) ((uintptr_t) injectPtr & addressMask),
+                               ptrLow, ptrHigh);
+         if (injectWordTypes & (1 << wordType))
+            break;
+      }
+      if (wordTries >= wordMaxTries) {
+         if (sdcDebug) fprintf(stderr, "SDC: no word of requested type found\n");
+         logf = fopen(logFilename,"a");
+         if (logf) {
+            logConfiguration(logf);
+            fprintf(logf, "Word Type Tries: %d\nNo %s found, not injected\n", wordTries,
+                    injectWordTypes ? "word of requested type" : "chipkill block in region");
+            fclose(logf);
+         }
+         return;
       }
-      map = map->next;
-   }
-   if (!map) {
-      if (sdcDebug) fprintf(stderr, "SDC: failed to find map for address %lx\n", randomAddress);
-      return NULL;
    }
    if (sdcDebug)
-      fprintf(stderr, "SDC: Injecting into (%s), (%lx - %lx)\n", map->name,
-              map->beginAddress, map->endAddress);
-   // re-map randomAddress to a real address
-   randomSize -= (map->endAddress - map->beginAddress); // remove last map size
-   randomAddress -= randomSize; // remove previous sizes to create offset
-   randomAddress += map->beginAddress; // create actual address in this map section
-   injectPtr = (unsigned long *) (randomAddress & addressMask); // need to realign after map base?
-   // if address is on read-only page, make it writeable
-   if (!(map->permissions & PERM_WRITE)) {
-      pagePtr = (char *)(((unsigned long)injectPtr) & ~(systemPageSize-1));
-      pagePerms = 0;
-      if (map->permissions & PERM_READ)
-         pagePerms |= PROT_READ;
-      if (map->permissions & PERM_EXEC)
-         pagePerms |= PROT_EXEC;
-      mprotect(pagePtr, systemPageSize, pagePerms | PROT_WRITE);
+      fprintf(stderr, "SDC: Injecting into (%s), (%lx - %lx) at %lx\n", map->name,
+              map->beginAddress, map->endAddress, randomAddress);
+   // outside regions, a classified word's type decides its bit fields
+   if (injectWordTypes && !(map->memoryClasses & MEM_REGION)) {
+      if (wordType == WORD_DOUBLE)
+         elemType = SDC_ELEM_DOUBLE;
+      else if (wordType == WORD_FLOAT) {
+         elemType = SDC_ELEM_FLOAT;
+         elemShift = (random() & 0x4) ? 32 : 0;
+      } else if (wordType == WORD_INT || wordType == WORD_POINTER)
+         elemType = SDC_ELEM_INT64;
    }
-   // generate bit to flip
-   injectVal = 0x1L << randomBit;
+   // generate bit(s) to flip
+   injectMask[0] = injectMask[1] = 0;
+   if (eccModel == eccNONE) {
+      // choose injectFlips distinct bits in the bit range or field
+      bitLow = injectBitLow;
+      bitHigh = injectBitHigh;
+      if (injectBitField != bitsRANGE)
+         fieldBitRange(injectBitField, elemType, elemShift, &bitLow, &bitHigh);
+      bitRange = bitHigh - bitLow + 1;
+      for (i = 0; i < injectFlips && i < bitRange; ) {
+         randomBit = bitLow + (random() >> 2) % bitRange;
+         if (!(injectMask[0] & (0x1UL << randomBit))) {
+            injectMask[0] |= 0x1UL << randomBit;
+            i++;
+         }
+      }
+   } else {
+      // only inject a raw error pattern the ECC would let through; the
+      // chipkill codeword is the 16-byte block holding the chosen word
+      if (eccModel == eccCHIPKILL)
+         injectPtr = (uint64_t *) blockAddress;
+      if (!eccScreen(eccModel, injectFlips, eccMaxCandidates,
+                     ((uint64_t) random()) << 31 | random(), injectMask, &eccStats)) {
+         if (sdcDebug) fprintf(stderr, "SDC: no silent error pattern found\n");
+         logf = fopen(logFilename,"a");
+         if (logf) {
+            logConfiguration(logf);
+            fprintf(logf, "ECC Screened: %lu patterns, %lu corrected, %lu detected, "
+                    "%lu silent\nNo silent error pattern, not injected\n",
+                    eccStats.candidates, eccStats.corrected, eccStats.detected,
+                    eccStats.silent);
+            fclose(logf);
+         }
+         return;
+      }
+      // if only one word of the block is corrupted, target just that word
+      if (!injectMask[0]) {
+         injectPtr++;
+         injectMask[0] = injectMask[1];
+         injectMask[1] = 0;
+      }
+      if (injectMask[1])
+         injectWords = 2;
+   }
+   randomBit = __builtin_ctzl(injectMask[0]);
    if (sdcDebug)
-      fprintf(stderr, "SDC: Injecting %lx at %p\n", injectVal, injectPtr);
+      fprintf(stderr, "SDC: Injecting %lx at %p\n", injectMask[0], injectPtr);
    // log info to log file
    logf = fopen(logFilename,"a");
    if (logf) {
-      fprintf(logf, "SDC Configuration:\nDelay %d\n", waitSecondsUntilInject);
-      fprintf(logf, "MPI Rank: %d\n", myMPIRank);
-      fprintf(logf, "Memory Type: %s\n", injectMTName[injectMemoryType]);
-      fprintf(logf, "Total (Write) Memory: %ld %ld\n", totalMemory, totalWriteMemory);
+      logConfiguration(logf);
       fprintf(logf, "Injected error info:\nAddress: %p\n", injectPtr);
-      fprintf(logf, "Bit number: %d\nBit mask: %lx\n", randomBit, injectVal);
+      fprintf(logf, "Bit number: %d\nBit mask: %lx\n", randomBit, injectMask[0]);
+      if (injectWords > 1)
+         fprintf(logf, "Bit mask 2: %lx\n", injectMask[1]);
+      if (injectEccModel != eccNONE)
+         fprintf(logf, "ECC Screened: %lu patterns, %lu corrected, %lu detected, "
+                 "%lu silent\n", eccStats.candidates, eccStats.corrected,
+                 eccStats.detected, eccStats.silent);
+      if (eccModel != injectEccModel)
+         fprintf(logf, "ECC Fallback: secded (region smaller than a chipkill block)\n");
+      if (wordType >= 0)
+         fprintf(logf, "Word Type: %s\nWord Type Tries: %d\n", wordTypeName[wordType],
+                 wordTries);
+      if (map->memoryClasses & MEM_REGION)
+         fprintf(logf, "Element Type: %s\nElement Address: %p\n",
+                 elemTypeName[map->elementType], (void *) elemAddress);
       fprintf(logf, "Map: %lx - %lx %x\nName: %s", map->beginAddress, map->endAddress, 
               map->permissions, map->name);
-      // if code, try to report what function was effected
-      if (map->permissions & PERM_EXEC) {
+      // if file-backed, try to report what function or variable was effected
+      if (map->name[0] == '/') {
          Dl_info dlinfo;
-         if (dladdr(injectPtr, &dlinfo)) {
+         if (dladdr(injectPtr, &dlinfo) && dlinfo.dli_sname) {
             fprintf(logf, " (%s,%p)", dlinfo.dli_sname, dlinfo.dli_saddr);
          }
       }
@@ -209,21 +598,72 @@ void* sdcInjectorStart(void *p)
       fclose(logf);
       logf = fopen(logFilename,"a");
       fprintf(logf, "\n");         
-      fprintf(logf, "Current value: %lx\n", *injectPtr);
+      fprintf(logf, "Page Size: %ld kB\nAnonHugePages: %ld kB\n",
+              map->kernelPageSize/1024, map->anonHugePages/1024);
+      // stratum weight lets stratified results be re-weighted to the whole
+      fprintf(logf, "Stratum: %s\nStratum Weight: %.9f\n", map->stratum,
+              (double) memoryClassSize(injectMemoryClasses, map->stratumId) /
+              memoryClassSize(injectMemoryClasses, -1));
+      // every class of the segment, for grouping results (see sdcagg)
+      fprintf(logf, "Memory Classes:");
+      for (i = 0, sep = ' '; i < sizeof(memClassName)/sizeof(char*); i++)
+         if (map->memoryClasses & (1 << i)) {
+            fprintf(logf, "%c%s", sep, memClassName[i]);
+            sep = '|';
+         }
+      fprintf(logf, "\n");
+      fprintf(logf, "Current value: %lx\n", injectPtr[0]);
+      if (injectWords > 1)
+         fprintf(logf, "Current value 2: %lx\n", injectPtr[1]);
       fflush(logf);
    }   
-   // XOR the chosen bit into the value at the chosen address
-   *injectPtr = (*injectPtr ^ injectVal); // flip the chosen injection bit
-   // if address is on read-only page, remove write permissions
-   if (!(map->permissions & PERM_WRITE)) {
-      mprotect(pagePtr, systemPageSize, pagePerms);
+   // XOR the chosen bits into the value(s) at the chosen address
+   for (i = 0; i < injectWords; i++) {
+      if (map->permissions & PERM_WRITE)
+         injectPtr[i] = (injectPtr[i] ^ injectMask[i]); // flip the chosen injection bits
+      else
+         writePath = writeProtectedWord(injectPtr+i, injectPtr[i] ^ injectMask[i], map);
    }
    // log info to log file
    if (logf) {
-      fprintf(logf, "New value: %lx\n", *injectPtr);
+      if (writePath >= 0)
+         fprintf(logf, "Write Path: %s\n", writePath ? "mprotect" : "/proc/self/mem");
+      else if (!(map->permissions & PERM_WRITE))
+         fprintf(logf, "Write Path: failed\n");
+      fprintf(logf, "New value: %lx\n", injectPtr[0]);
+      if (injectWords > 1)
+         fprintf(logf, "New value 2: %lx\n", injectPtr[1]);
    }
    fflush(logf);
    fclose(logf);
+}
+
+/**
+* @brief Thread routine for injecting SDC error(s)
+*
+* @param p is required pthread start-function parameter, not used
+* @return NULL always
+* @details This function is started in its own thread, and its job
+* is to simply sleep for the specified number of seconds, or wait for
+* the trigger event, then inject an error. Once an error is injected,
+* this function returns and the thread dies.
+**/
+void* sdcInjectorStart(void *p)
+{
+   if (triggerEvent >= 0) {
+      if (sdcDebug>1)
+         fprintf(stderr, "In SDC thread, waiting for %s\n", triggerName);
+      waitForTrigger();
+   } else {
+      if (sdcDebug>1)
+         fprintf(stderr, "In SDC thread, waiting %d seconds\n", waitSecondsUntilInject);
+      // go to sleep for awhile
+      sleep(waitSecondsUntilInject);
+   }
+   // awake, now inject a bit error
+   injectError();
+   // let the thread that hit the trigger event continue
+   triggerDone();
    return NULL;
 }
 
@@ -253,6 +693,21 @@ void __attribute__((destructor)) sdcTesterFinalize(void)
 /* for non-gnu compilers */
 //#pragma fini sdcTesterFinalize
 
+/**
+* @brief Find the MPI rank of this process from the launcher's environment
+* @return rank, or -1 if this is not an MPI process (e.g., mpirun itself)
+**/
+static int getMPIRank(void)
+{
+   char* enval;
+   enval = getenv("OMPI_COMM_WORLD_RANK");
+   if (!enval)
+      enval = getenv("OMPI_MCA_ns_nds_vpid");
+   if (!enval)
+      return -1;
+   return atoi(enval);
+}
+
 /**
 * @brief sdcTesterInitialize(): initialization routine for SDC Tester.
 *
@@ -267,44 +722,53 @@ void __attribute__((constructor)) sdcTesterInitialize(void)
    char* enval;
    long ival;
    unsigned int myPid;
+   int actualRank, planStatus = 0;
+   PlanEntry planEntry;
    
    if (sdcDebug) 
       fprintf(stderr, "SDC Tester Initializing\n");;
       
    systemPageSize = getpagesize();
    myPid = getpid();
+   actualRank = getMPIRank();
    
-   // check if we are injecting into an MPI program
-   enval = getenv("SDC_MPIONLY");
+   // a campaign plan, if given, decides which processes get injected
+   enval = getenv("SDC_PLAN");
    if (enval) {
-      enval = getenv("OMPI_COMM_WORLD_RANK");
-      if (!enval)
-         enval = getenv("OMPI_MCA_ns_nds_vpid");
-      if (!enval) {
-         // then we are not one of the MPI processes, but are probably
-         // mpirun, so we should not inject an error
+      char *trialval = getenv("SDC_TRIAL");
+      int trial = trialval ? atoi(trialval) : 0;
+      planStatus = lookupPlanEntry(enval, trial, actualRank, &planEntry);
+      if (planStatus < 0)
+         fprintf(stderr, "SDC: Bad plan file (%s)\n", enval);
+      if (planStatus <= 0) {
+         // then this process is not in the plan, so don't do anything
          return;
       }
-   }
-   // check if we are injecting into one MPI process
-   enval = getenv("SDC_MPIRANK");
-   if (enval) {
-      int actualRank = -1;
-      int desiredRank = atoi(enval);
-      enval = getenv("OMPI_COMM_WORLD_RANK");
-      if (!enval)
-         enval = getenv("OMPI_MCA_ns_nds_vpid");
-      if (!enval) {
-         // then no rank determined, so don't do anything
+      myMPIRank = actualRank;
+      campaignTrial = trial;
+   } else {
+      // check if we are injecting into an MPI program
+      enval = getenv("SDC_MPIONLY");
+      if (enval && actualRank < 0) {
+         // then we are not one of the MPI processes, but are probably
+         // mpirun, so we should not inject an error
          return;
       }
-      actualRank = atoi(enval);
-      if (desiredRank != actualRank) {
-         // then not correct rank, so don't do anything
-         return;
+      // check if we are injecting into one MPI process
+      enval = getenv("SDC_MPIRANK");
+      if (enval) {
+         int desiredRank = atoi(enval);
+         if (actualRank < 0) {
+            // then no rank determined, so don't do anything
+            return;
+         }
+         if (desiredRank != actualRank) {
+            // then not correct rank, so don't do anything
+            return;
+         }
+         myMPIRank = actualRank;
+         //fprintf(stderr,"%d: Correct rank %d, injecting error\n", myPid, actualRank);
       }
-      myMPIRank = actualRank;
-      //fprintf(stderr,"%d: Correct rank %d, injecting error\n", myPid, actualRank);
    }
    
    enval = getenv("SDC_DELAY");
@@ -315,24 +779,113 @@ void __attribute__((constructor)) sdcTesterInitialize(void)
       else
          fprintf(stderr, "SDC: Bad value (%s) for SDC_DELAY!\n", enval);
    }
+   enval = getenv("SDC_TRIGGER");
+   if (enval) {
+      if (setTrigger(enval))
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_TRIGGER\n", enval);
+   }
    enval = getenv("SDC_MEMTYPE");
    if (enval) {
-      if (!strcasecmp(enval, "all"))
-         injectMemoryType = injectALL;
-      else if (!strcasecmp(enval, "data"))
-         injectMemoryType = injectDATA;
-      else if (!strcasecmp(enval, "code"))
-         injectMemoryType = injectCODE;
-      else if (!strcasecmp(enval, "appdata"))
-         injectMemoryType = injectAPPDATA;
-      else if (!strcasecmp(enval, "heap"))
-         injectMemoryType = injectHEAP;
-      else if (!strcasecmp(enval, "stack"))
-         injectMemoryType = injectSTACK;
-      else
+      if (setMemoryType(enval))
          fprintf(stderr, "SDC: Bad value (%s) for SDC_MEMTYPE\n", enval);
-   } else
-      injectMemoryType = injectDATA;
+   }
+   enval = getenv("SDC_MODE");
+   if (enval) {
+      if (!(ival = parseInjectMode(enval)))
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_MODE\n", enval);
+      else
+         injectMode = ival;
+   }
+   enval = getenv("SDC_REGTYPE");
+   if (enval) {
+      if (!(ival = parseRegisterType(enval)))
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_REGTYPE\n", enval);
+      else
+         injectRegisterType = ival;
+   }
+   enval = getenv("SDC_SIGNAL");
+   if (enval) {
+      ival = strtol(enval,0,0);
+      if (ival >= 0 && ival <= SIGRTMAX-SIGRTMIN)
+         registerSignalOffset = ival;
+      else
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_SIGNAL!\n", enval);
+   }
+   enval = getenv("SDC_STRATUM");
+   if (enval) {
+      strncpy(injectStratum, enval, sizeof(injectStratum)-1);
+   }
+   enval = getenv("SDC_BITS");
+   if (enval) {
+      if ((ival = parseBitField(enval)))
+         injectBitField = ival;
+      else if (parseBitRange(enval, &injectBitLow, &injectBitHigh))
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_BITS\n", enval);
+   }
+   enval = getenv("SDC_WORDTYPE");
+   if (enval) {
+      if (setWordType(enval))
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_WORDTYPE\n", enval);
+   }
+   enval = getenv("SDC_WORDTRIES");
+   if (enval) {
+      ival = strtol(enval,0,0);
+      if (ival > 0 && ival <= 1000000000)
+         wordMaxTries = ival;
+      else
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_WORDTRIES!\n", enval);
+   }
+   enval = getenv("SDC_ECC");
+   if (enval) {
+      if ((ival = parseEccModel(enval)) < 0)
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_ECC\n", enval);
+      else
+         injectEccModel = ival;
+   }
+   enval = getenv("SDC_FLIPS");
+   if (enval) {
+      ival = strtol(enval,0,0);
+      if (ival >= 1 && ival <= MAX_ECC_FLIPS)
+         injectFlips = ival;
+      else
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_FLIPS!\n", enval);
+   }
+   enval = getenv("SDC_ECCMAX");
+   if (enval) {
+      ival = strtol(enval,0,0);
+      if (ival > 0)
+         eccMaxCandidates = ival;
+      else
+         fprintf(stderr, "SDC: Bad value (%s) for SDC_ECCMAX!\n", enval);
+   }
+   // settings in the plan entry override the environment
+   if (planStatus > 0) {
+      if (planEntry.delay != -1)
+         waitSecondsUntilInject = planEntry.delay;
+      if (planEntry.trigger[0])
+         setTrigger(planEntry.trigger);
+      if (planEntry.memoryType[0])
+         setMemoryType(planEntry.memoryType);
+      if (planEntry.mode != -1)
+         injectMode = planEntry.mode;
+      if (planEntry.registerType != -1)
+         injectRegisterType = planEntry.registerType;
+      if (planEntry.bitLow != -1) {
+         injectBitLow = planEntry.bitLow;
+         injectBitHigh = planEntry.bitHigh;
+         injectBitField = bitsRANGE;
+      }
+      if (planEntry.bitField != -1)
+         injectBitField = planEntry.bitField;
+      if (planEntry.stratum[0])
+         strcpy(injectStratum, planEntry.stratum);
+      if (planEntry.wordType[0])
+         setWordType(planEntry.wordType);
+      if (planEntry.ecc != -1)
+         injectEccModel = planEntry.ecc;
+      if (planEntry.flips != -1)
+         injectFlips = planEntry.flips;
+   }
 
    enval = getenv("SDC_OUTFILE");
    if (enval) {
@@ -346,8 +899,12 @@ void __attribute__((constructor)) sdcTesterInitialize(void)
    // dumpMemoryMap(0);
    
 #ifndef TESTING
+   if (triggerEvent >= 0)
+      armTrigger(triggerEvent, triggerCount);
    // create bit error injector thread
    pthread_create(&sdcInjectorThread, NULL, sdcInjectorStart, NULL);
+#else
+   triggerEvent = -1; // nothing calls the trigger events in the test driver
 #endif
 }
 /* for non-gnu compilers */
@@ -0,0 +1,304 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Campaign plan file lookup and configuration value parsing
+*
+* @details A campaign plan is a compact binary file (compiled from a
+* text manifest by sdcplan) that holds a per-(trial,rank) injector
+* configuration. Every process maps the same file read-only, so a node
+* shares one page-cache copy, and each process finds its own entry with
+* one index computation. The string parsers here are shared by the
+* environment variable handling in injector.c and by sdcplan.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sdc.h"
+
+extern int sdcDebug;
+
+/**
+* @brief Parse a memory type, an OR of memory class names
+*
+* @param spec is class names separated by '|' or ',', e.g. "heap|stack";
+* names are 'all', the MEM_CLASS_NAMES, and 'dso:NAME' for the shared
+* libraries whose file name contains NAME
+* @param patterns if not null, receives a copy of each dso: NAME
+* @param numPatterns is the number of patterns so far, updated
+* @return OR of MEM_* bits, or 0 if spec is not valid
+**/
+unsigned int parseMemoryType(const char *spec, char **patterns, int *numPatterns)
+{
+   char *className[] = MEM_CLASS_NAMES;
+   char buf[256], *name, *save;
+   unsigned int classes = 0;
+   int i;
+   if (strlen(spec) >= sizeof(buf))
+      return 0;
+   strcpy(buf, spec);
+   for (name = strtok_r(buf, "|,", &save); name; name = strtok_r(0, "|,", &save)) {
+      if (!strcasecmp(name, "all")) {
+         classes |= MEM_ALL;
+         continue;
+      }
+      if (!strncasecmp(name, "dso:", 4) && name[4]) {
+         if (*numPatterns >= MAX_DSO_PATTERNS)
+            return 0;
+         if (patterns)
+            patterns[*numPatterns] = strdup(name+4);
+         classes |= MEM_DSO_MATCH(*numPatterns);
+         (*numPatterns)++;
+         continue;
+      }
+      for (i = 0; i < sizeof(className)/sizeof(char*); i++)
+         if (!strcasecmp(name, className[i]))
+            break;
+      if (i == sizeof(className)/sizeof(char*))
+         return 0;
+      classes |= (1 << i);
+   }
+   return classes;
+}
+
+/**
+* @brief Parse a word type, an OR of word type names
+*
+* @param spec is WORD_TYPE_NAMES separated by '|' or ',', e.g. "float|double"
+* @return OR of 1<<WORD_* bits, or 0 if spec is not valid
+**/
+unsigned int parseWordType(const char *spec)
+{
+   char *typeName[] = WORD_TYPE_NAMES;
+   char buf[64], *name, *save;
+   unsigned int types = 0;
+   int i;
+   if (strlen(spec) >= sizeof(buf))
+      return 0;
+   strcpy(buf, spec);
+   for (name = strtok_r(buf, "|,", &save); name; name = strtok_r(0, "|,", &save)) {
+      for (i = 0; i < NUM_WORD_TYPES; i++)
+         if (!strcasecmp(name, typeName[i]))
+            break;
+      if (i == NUM_WORD_TYPES)
+         return 0;
+      types |= (1 << i);
+   }
+   return types;
+}
+
+/**
+* @brief Parse an event trigger, "MPI_Name:N" or "point:ID:N"
+*
+* @param count is set to N, the event count that triggers the injection
+* @return event number, or -1 if spec is not valid
+**/
+int parseTrigger(const char *spec, unsigned long *count)
+{
+   char *mpiName[] = SDC_MPI_EVENT_NAMES;
+   const char *sep;
+   char *end;
+   long id;
+   int i, event = -1;
+   sep = strrchr(spec, ':');
+   if (!sep)
+      return -1;
+   if (!strncasecmp(spec, "point:", 6)) {
+      id = strtol(spec+6, &end, 0);
+      if (end == spec+6 || end != sep || id < 0 || id >= MAX_INJECT_POINTS)
+         return -1;
+      event = EVENT_INJECT_POINT(id);
+   } else {
+      for (i = 0; i < NUM_MPI_EVENTS; i++)
+         if (strlen(mpiName[i]) == sep-spec && !strncasecmp(spec, mpiName[i], sep-spec))
+            event = i;
+   }
+   *count = strtoul(sep+1, &end, 0);
+   if (event < 0 || *end || end == sep+1 || *count == 0)
+      return -1;
+   return event;
+}
+
+/**
+* @brief Parse an injection mode name
+* @return InjectMode value, or 0 if name is not valid
+**/
+int parseInjectMode(const char *name)
+{
+   if (!strcasecmp(name, "memory"))
+      return injectMEMORY;
+   else if (!strcasecmp(name, "register"))
+      return injectREGISTER;
+   return 0;
+}
+
+/**
+* @brief Parse a register type name
+* @return REGS_* bits, or 0 if name is not valid
+**/
+int parseRegisterType(const char *name)
+{
+   if (!strcasecmp(name, "all"))
+      return REGS_GPR|REGS_VECTOR;
+   else if (!strcasecmp(name, "gpr"))
+      return REGS_GPR;
+   else if (!strcasecmp(name, "vector"))
+      return REGS_VECTOR;
+   return 0;
+}
+
+/**
+* @brief Parse an ECC model name
+* @return EccModel value, or -1 if name is not valid
+**/
+int parseEccModel(const char *name)
+{
+   char *modelName[] = ECC_MODEL_NAMES;
+   int i;
+   for (i = 0; i < sizeof(modelName)/sizeof(char*); i++)
+      if (!strcasecmp(name, modelName[i]))
+         return i;
+   return -1;
+}
+
+/**
+* @brief Parse an element bit field name
+* @return bitsSIGN, bitsEXPONENT or bitsMANTISSA, or 0 if name is not one
+**/
+int parseBitField(const char *name)
+{
+   char *fieldName[] = BIT_FIELD_NAMES;
+   int i;
+   for (i = bitsSIGN; i < sizeof(fieldName)/sizeof(char*); i++)
+      if (!strcasecmp(name, fieldName[i]))
+         return i;
+   return 0;
+}
+
+/**
+* @brief Parse a bit range, either "N" or "LOW-HIGH", within 0-63
+* @return 0 on success, -1 if not valid
+**/
+int parseBitRange(const char *range, int *low, int *high)
+{
+   char *end;
+   long lo, hi;
+   lo = strtol(range, &end, 0);
+   if (end == range)
+      return -1;
+   hi = lo;
+   if (*end == '-') {
+      range = end+1;
+      hi = strtol(range, &end, 0);
+      if (end == range)
+         return -1;
+   }
+   if (*end || lo < 0 || hi > 63 || lo > hi)
+      return -1;
+   *low = lo;
+   *high = hi;
+   return 0;
+}
+
+/**
+* @brief Check that a plan entry's fields are each unset (-1 or empty)
+* or valid, so a corrupt plan file cannot configure the injector
+* @return 0 if valid, -1 if not
+**/
+static int checkPlanEntry(PlanEntry *entry)
+{
+   unsigned long count;
+   int numPatterns = 0;
+   if (!memchr(entry->memoryType, 0, sizeof(entry->memoryType)) ||
+       !memchr(entry->trigger, 0, sizeof(entry->trigger)) ||
+       !memchr(entry->wordType, 0, sizeof(entry->wordType)) ||
+       !memchr(entry->stratum, 0, sizeof(entry->stratum)))
+      return -1;
+   if (entry->delay < -1 ||
+       (entry->mode != -1 && entry->mode != injectMEMORY &&
+        entry->mode != injectREGISTER) ||
+       (entry->registerType != -1 &&
+        (entry->registerType < REGS_GPR || entry->registerType > (REGS_GPR|REGS_VECTOR))) ||
+       ((entry->bitLow != -1 || entry->bitHigh != -1) &&
+        (entry->bitLow < 0 || entry->bitHigh > 63 || entry->bitLow > entry->bitHigh)) ||
+       (entry->bitField != -1 &&
+        (entry->bitField < bitsSIGN || entry->bitField > bitsMANTISSA)) ||
+       (entry->ecc != -1 && (entry->ecc < eccNONE || entry->ecc > eccCHIPKILL)) ||
+       (entry->flips != -1 && (entry->flips < 1 || entry->flips > MAX_ECC_FLIPS)))
+      return -1;
+   if ((entry->memoryType[0] && !parseMemoryType(entry->memoryType, 0, &numPatterns)) ||
+       (entry->trigger[0] && parseTrigger(entry->trigger, &count) < 0) ||
+       (entry->wordType[0] && !parseWordType(entry->wordType)))
+      return -1;
+   return 0;
+}
+
+/**
+* @brief Look up this process's entry in a campaign plan file
+*
+* @param filename is the compiled plan file
+* @param trial is the campaign trial number of this run
+* @param rank is the MPI rank of this process (-1 if none)
+* @param entry is filled in with the configuration if one is found
+* @return 1 if an entry was found, 0 if this process should not be
+* injected, -1 if the plan file (or this process's entry) is not usable
+* @details A process with no rank (e.g., mpirun) is never in an MPI
+* campaign's plan, so it is naturally left alone.
+**/
+int lookupPlanEntry(const char *filename, int trial, int rank, PlanEntry *entry)
+{
+   int fd, found = 0;
+   struct stat st;
+   char *plan;
+   PlanHeader *hdr;
+   unsigned long slot, numSlots;
+   uint16_t config;
+   fd = open(filename, O_RDONLY);
+   if (fd < 0)
+      return -1;
+   if (fstat(fd, &st) || st.st_size < sizeof(PlanHeader)) {
+      close(fd);
+      return -1;
+   }
+   plan = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (plan == MAP_FAILED)
+      return -1;
+   hdr = (PlanHeader*) plan;
+   numSlots = (unsigned long) hdr->numTrials * (hdr->numRanks > 0 ? hdr->numRanks : 1);
+   if (memcmp(hdr->magic, PLAN_MAGIC, sizeof(hdr->magic)) ||
+       hdr->entrySize != sizeof(PlanEntry) || hdr->numConfigs < 0 ||
+       st.st_size < sizeof(PlanHeader) + hdr->numConfigs*sizeof(PlanEntry) +
+                    numSlots*sizeof(uint16_t)) {
+      munmap(plan, st.st_size);
+      return -1;
+   }
+   if (trial < 0 || trial >= hdr->numTrials ||
+       (hdr->numRanks > 0 && (rank < 0 || rank >= hdr->numRanks))) {
+      munmap(plan, st.st_size);
+      return 0;
+   }
+   slot = (unsigned long) trial * (hdr->numRanks > 0 ? hdr->numRanks : 1);
+   if (hdr->numRanks > 0)
+      slot += rank;
+   config = ((uint16_t*) (plan + sizeof(PlanHeader) +
+                          hdr->numConfigs*sizeof(PlanEntry)))[slot];
+   if (config && config <= hdr->numConfigs) {
+      memcpy(entry, plan + sizeof(PlanHeader) + (config-1)*sizeof(PlanEntry),
+             sizeof(PlanEntry));
+      found = checkPlanEntry(entry) ? -1 : 1;
+   } else if (config)
+      found = -1;
+   if (sdcDebug)
+      fprintf(stderr, "SDC: plan %s trial %d rank %d config %d\n", filename,
+              trial, rank, config);
+   munmap(plan, st.st_size);
+   return found;
+}
@@ -0,0 +1,111 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief MPI profiling-interface wrappers that count injection events
+*
+* @details Each wrapper counts the call (see trigger.c) and then calls
+* the real routine through its PMPI_ name, so SDC_TRIGGER=MPI_Allreduce:500
+* injects the error right before the 500th MPI_Allreduce. Only built into
+* the library with 'make MPI=1'; the PMPI_ routines are resolved from the
+* application's MPI library at run time.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <mpi.h>
+#include "sdc.h"
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_ALLREDUCE);
+   return PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+               MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_REDUCE);
+   return PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root,
+              MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_BCAST);
+   return PMPI_Bcast(buffer, count, datatype, root, comm);
+}
+
+int MPI_Barrier(MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_BARRIER);
+   return PMPI_Barrier(comm);
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_ALLGATHER);
+   return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                         recvtype, comm);
+}
+
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_ALLTOALL);
+   return PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                        recvtype, comm);
+}
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest,
+             int tag, MPI_Comm comm)
+{
+   SDC_COUNT_EVENT(eventMPI_SEND);
+   return PMPI_Send(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source,
+             int tag, MPI_Comm comm, MPI_Status *status)
+{
+   SDC_COUNT_EVENT(eventMPI_RECV);
+   return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request *request)
+{
+   SDC_COUNT_EVENT(eventMPI_ISEND);
+   return PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request *request)
+{
+   SDC_COUNT_EVENT(eventMPI_IRECV);
+   return PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 int dest, int sendtag, void *recvbuf, int recvcount,
+                 MPI_Datatype recvtype, int source, int recvtag,
+                 MPI_Comm comm, MPI_Status *status)
+{
+   SDC_COUNT_EVENT(eventMPI_SENDRECV);
+   return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf,
+                        recvcount, recvtype, source, recvtag, comm, status);
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)
+{
+   SDC_COUNT_EVENT(eventMPI_WAIT);
+   return PMPI_Wait(request, status);
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[])
+{
+   SDC_COUNT_EVENT(eventMPI_WAITALL);
+   return PMPI_Waitall(count, requests, statuses);
+}
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include "sdc.h"
 
@@ -30,54 +31,238 @@ EXTERN unsigned long totalCodeMemory;
 EXTERN unsigned long totalHeapMemory;
 EXTERN unsigned long totalStackMemory;
 EXTERN unsigned long totalAppDataMemory;
+EXTERN unsigned long totalClassMemory[NUM_MEM_CLASSES];
+EXTERN char *dsoPatterns[MAX_DSO_PATTERNS];
+EXTERN int numDsoPatterns;
+EXTERN int skipSpecialMaps;
 EXTERN int sdcDebug;
 
+static int numStrata = 0;
+
+// routine from region.c
+int snapshotRegions(SdcRegion *out, int max);
+
+// index of the segments that can currently be chosen for injection
+static struct {
+   MapSegment *segment;
+   unsigned long endOffset;  // cumulative size up to end of this segment
+} *selectIndex = 0;
+static int selectIndexSize = 0, selectIndexCount = 0;
+
+/**
+* @brief Compute the memory class bits of a segment
+*
+* @details When words are classified (SDC_WORDTYPE), whole pages of the
+* candidates are read, so the kernel's special mappings that can fault
+* when read ([vvar], [vsyscall]) are left out of every class.
+**/
+static unsigned int classifySegment(char *perms, char *name, char *appName)
+{
+   unsigned int classes = 0;
+   char *base;
+   int i;
+   if (skipSpecialMaps && (!strncmp(name, "[vvar", 5) || !strcmp(name, "[vsyscall]")))
+      return 0;
+   if (perms[2]=='x')
+      classes |= MEM_CODE;
+   if (perms[1]=='w')
+      classes |= MEM_DATA;
+   if (perms[1]!='w' && perms[2]!='x')
+      classes |= MEM_RODATA;
+   if (name[0] != '/' && perms[1]=='w')
+      classes |= MEM_ANON;
+   if (perms[1]=='w' && !strcmp(name,"[heap]"))
+      classes |= MEM_HEAP;
+   if (perms[1]=='w' && !strcmp(name,"[stack]"))
+      classes |= MEM_STACK;
+   if (name[0] == '/') {
+      if (!strcmp(name,appName)) {
+         if (perms[1]=='w')
+            classes |= MEM_APPDATA;
+      } else if (strstr(name, ".so"))
+         classes |= MEM_DSO;
+      base = strrchr(name, '/') + 1;
+      for (i = 0; i < numDsoPatterns; i++)
+         if (strstr(base, dsoPatterns[i]))
+            classes |= MEM_DSO_MATCH(i);
+   }
+   return classes;
+}
+
 /**
-* @brief Read and parse /proc/[pid]/maps file for memory map
+* @brief Add one segment to the memory map and the memory totals
+*
+* @details Sizes are from the segment's smaps fields (in KB). The
+* segment's extent is first adjusted to more closely match its
+* resident set size.
+**/
+static void addSegment(unsigned long beginAddr, unsigned long endAddr, char *perms,
+                       char *name, char *appName, unsigned long absSize,
+                       unsigned long rssSize, unsigned long pageSize,
+                       unsigned long anonHugeSize)
+{
+   MapSegment *newSeg, *seg;
+   static MapSegment *tailSeg;
+   char stratum[160];
+   unsigned long mapBegin = beginAddr, mapEnd = endAddr;
+   int i;
+   if (sdcDebug>1)
+      fprintf(stderr, "absSize = %ld  rssSize = %ld\n", absSize, rssSize);
+   // adjust map size to more closely match resident set size
+   if (rssSize < absSize) {
+      if (strstr(name,"[stack]"))
+         beginAddr = endAddr - (rssSize * 1024); // stack grows downward
+      else if (perms[2]=='x')
+         ; // is a code segment, so no idea what pages are out, just leave as is
+      else if (strstr(name, "[heap]"))
+         endAddr = beginAddr + (rssSize * 1024); // heap grows upward
+      else if (rssSize < absSize/4) {
+         // only adjust unknown segments if the rss is less than 1/4 of the whole
+         // this will handle the worst cases, like openmpi's huge but 
+         // little used shared memory pool segment
+         endAddr = beginAddr + (rssSize * 1024); // assume this segment grows up
+      }
+   }
+   if (sdcDebug>1)
+      fprintf(stderr, "(%s) (%lx %lx %s)\n", name, beginAddr, endAddr, perms);
+   // set up new map record
+   newSeg = (MapSegment*) malloc(sizeof(MapSegment));
+   newSeg->beginAddress = beginAddr;
+   newSeg->endAddress = endAddr;
+   newSeg->mapBegin = mapBegin;
+   newSeg->mapEnd = mapEnd;
+   newSeg->permissions  = (perms[0]=='r'? PERM_READ : 0);
+   newSeg->permissions |= (perms[1]=='w'? PERM_WRITE : 0);
+   newSeg->permissions |= (perms[2]=='x'? PERM_EXEC : 0);
+   newSeg->permissions |= (perms[3]=='s'? PERM_SHARED : 0);
+   newSeg->permissions |= (perms[3]=='p'? PERM_PRIVATE : 0);
+   newSeg->kernelPageSize = pageSize * 1024;
+   newSeg->anonHugePages = anonHugeSize * 1024;
+   newSeg->name = strdup(name);
+   // stratum is the segment's class plus its name (DSO path, [heap], etc.)
+   sprintf(stratum, "%s:%s", perms[2]=='x'? "code" : perms[1]=='w'? "data" : "rodata",
+           name);
+   newSeg->stratum = strdup(stratum);
+   // segments of one stratum share an id, so selection compares integers
+   newSeg->stratumId = numStrata;
+   for (seg = memoryMap; seg; seg = seg->next)
+      if (!strcmp(seg->stratum, stratum)) {
+         newSeg->stratumId = seg->stratumId;
+         break;
+      }
+   if (newSeg->stratumId == numStrata)
+      numStrata++;
+   newSeg->memoryClasses = classifySegment(perms, name, appName);
+   newSeg->elementType = SDC_ELEM_BYTES;
+   newSeg->next = 0;
+   if (!memoryMap) {
+      memoryMap = tailSeg = newSeg;
+   } else {
+      tailSeg->next = newSeg;
+      tailSeg = newSeg;
+   }
+   // if no access permissions then don't count in totals
+   if (!(newSeg->permissions & (PERM_READ|PERM_WRITE|PERM_EXEC)))
+      return;
+   // increment the appropriate total memory counts
+   totalMemory += (endAddr - beginAddr);
+   if (newSeg->permissions & PERM_READ) 
+      totalReadMemory += (endAddr - beginAddr);
+   if (newSeg->permissions & PERM_WRITE) 
+      totalWriteMemory += (endAddr - beginAddr);
+   if (newSeg->permissions & PERM_EXEC) 
+      totalCodeMemory += (endAddr - beginAddr);
+   if (!strcmp(name,appName) && newSeg->permissions & PERM_WRITE) 
+      totalAppDataMemory += (endAddr - beginAddr);
+   if (!strcmp(name,"[heap]") && newSeg->permissions & PERM_WRITE) 
+      totalHeapMemory += (endAddr - beginAddr);
+   if (!strcmp(name,"[stack]") && newSeg->permissions & PERM_WRITE) 
+      totalStackMemory += (endAddr - beginAddr);
+   for (i = 0; i < NUM_MEM_CLASSES; i++)
+      if (newSeg->memoryClasses & (1<<i))
+         totalClassMemory[i] += (endAddr - beginAddr);
+}
+
+/**
+* @brief Read and parse /proc/[pid]/smaps file for memory map
+*
+* @details Each segment's header line is followed by "Key: value kB"
+* field lines; the fields used (Size, Rss, KernelPageSize and
+* AnonHugePages) are picked out by name since their order and number
+* vary between kernel versions.
 **/
 int readProcSmaps(int pid)
 {
    FILE *f;
    char line[256];
-   int myPid, matched;
-   unsigned int absSize, rssSize; // segment sizes from file
-   unsigned long beginAddr, endAddr, offset, inode;
-   char perms[5], dev[4];
-   char name[128], appName[128];
-   MapSegment *newSeg, *tailSeg;
+   int myPid, matched, pending;
+   unsigned long absSize, rssSize, pageSize, anonHugeSize; // in KB from file
+   unsigned long beginAddr, endAddr, offset, inode, value;
+   unsigned long pendBegin = 0, pendEnd = 0;
+   char perms[5], dev[4], pendPerms[5];
+   char name[128], appName[128], pendName[128], field[32];
+   MapSegment *nextSeg;
    if (pid <= 0)
       myPid = getpid();
    else
       myPid = pid;
-   sprintf(line, "/proc/%d/smaps", myPid); // maybe use smaps?
+   sprintf(line, "/proc/%d/smaps", myPid);
    f = fopen(line, "r");
    if (!f) 
       return -1;
-   strcpy(name,"none");
    appName[0] = '\0';
    // if re-reading, then clear old map
    while (memoryMap) {
-      newSeg = memoryMap->next;
+      nextSeg = memoryMap->next;
       if (memoryMap->name) {
          free(memoryMap->name);
          memoryMap->name = 0;
       }
+      if (memoryMap->stratum) {
+         free(memoryMap->stratum);
+         memoryMap->stratum = 0;
+      }
       memoryMap->next = 0;
       free(memoryMap);
-      memoryMap = newSeg;
+      memoryMap = nextSeg;
    }
-   newSeg = tailSeg = 0;
-   totalMemory = totalWriteMemory = 0;
+   totalMemory = totalReadMemory = totalWriteMemory = totalCodeMemory = 0;
+   totalAppDataMemory = totalHeapMemory = totalStackMemory = 0;
+   memset(totalClassMemory, 0, sizeof(totalClassMemory));
+   numStrata = 0;
+   selectIndexCount = 0;
+   pending = 0;
+   absSize = rssSize = pageSize = anonHugeSize = 0;
+   beginAddr = endAddr = 0;
    // walk through file lines and extract memory map info
    while (fgets(line, sizeof(line), f) != NULL) {
       line[strlen(line)-1] = '\0';
       if (sdcDebug>1)
          fprintf(stderr, "(%s)\n",line);
+      // field line for the current segment?
+      if (sscanf(line, "%31[A-Za-z_]: %lu", field, &value) == 2) {
+         if (!strcmp(field, "Size"))
+            absSize = value;
+         else if (!strcmp(field, "Rss"))
+            rssSize = value;
+         else if (!strcmp(field, "KernelPageSize"))
+            pageSize = value;
+         else if (!strcmp(field, "AnonHugePages"))
+            anonHugeSize = value;
+         continue;
+      }
+      strcpy(name,"none");
       matched = sscanf(line, "%lx-%lx %c%c%c%c %lx %c%c:%c%c %ld %127s", &beginAddr, 
                        &endAddr, &perms[0], &perms[1], &perms[2], &perms[3], 
-                       &offset, &dev[0], &dev[1], &dev[2], &dev[3], &inode, &name);
+                       &offset, &dev[0], &dev[1], &dev[2], &dev[3], &inode, name);
       if (matched < 7) 
          continue;
+      // new segment header, so finish the previous segment
+      if (pending)
+         addSegment(pendBegin, pendEnd, pendPerms, pendName, appName, absSize,
+                    rssSize, pageSize, anonHugeSize);
+      pending = 0;
+      absSize = rssSize = pageSize = anonHugeSize = 0;
       // if map is of the injector library, skip (since it should be invisible)
       if (strstr(name,"libsdc.so"))
          continue;
@@ -88,81 +273,193 @@ int readProcSmaps(int pid)
       if (!appName[0] && strcmp(name,"none")) {
          strcpy(appName, name);
       }
-      // read next two file lines for size and rss size (in KB)
-      if (fgets(line, sizeof(line), f) == NULL) break;
-      sscanf(line, "Size: %u", &absSize);
-      if (fgets(line, sizeof(line), f) == NULL) break;
-      sscanf(line, "Rss: %u", &rssSize);
-      if (sdcDebug>1)
-         fprintf(stderr, "absSize = %d  rssSize = %d\n", absSize, rssSize);
-      // adjust map size to more closely match resident set size
-      if (rssSize < absSize) {
-         if (strstr(name,"[stack]"))
-            beginAddr = endAddr - (rssSize * 1024); // stack grows downward
-         else if (perms[2]=='x')
-            ; // is a code segment, so no idea what pages are out, just leave as is
-         else if (strstr(name, "[heap]"))
-            endAddr = beginAddr + (rssSize * 1024); // heap grows upward
-         else if (rssSize < absSize/4) {
-            // only adjust unknown segments if the rss is less than 1/4 of the whole
-            // this will handle the worst cases, like openmpi's huge but 
-            // little used shared memory pool segment
-            endAddr = beginAddr + (rssSize * 1024); // assume this segment grows up
-         }
-      }
       // make perms a string
       perms[4] = '\0';
-      if (sdcDebug>1)
-         fprintf(stderr, "num matches: %d (%s) (%lx %lx %s)\n", matched, name, 
-                 beginAddr, endAddr, perms);
-      // set up new map record
-      newSeg = (MapSegment*) malloc(sizeof(MapSegment));
-      newSeg->beginAddress = beginAddr;
-      newSeg->endAddress = endAddr;
-      newSeg->permissions  = (perms[0]=='r'? PERM_READ : 0);
-      newSeg->permissions |= (perms[1]=='w'? PERM_WRITE : 0);
-      newSeg->permissions |= (perms[2]=='x'? PERM_EXEC : 0);
-      newSeg->permissions |= (perms[3]=='s'? PERM_SHARED : 0);
-      newSeg->permissions |= (perms[3]=='p'? PERM_PRIVATE : 0);
-      newSeg->name = strdup(name);
-      newSeg->next = 0;
-      if (!memoryMap) {
-         memoryMap = tailSeg = newSeg;
-      } else {
-         tailSeg->next = newSeg;
-         tailSeg = newSeg;
-      }
-      // if no access permissions then don't count in totals
-      if (!(newSeg->permissions & (PERM_READ|PERM_WRITE|PERM_EXEC)))
-         continue;
-      // increment the appropriate total memory counts
-      totalMemory += (endAddr - beginAddr);
-      if (newSeg->permissions & PERM_READ) 
-         totalReadMemory += (endAddr - beginAddr);
-      if (newSeg->permissions & PERM_WRITE) 
-         totalWriteMemory += (endAddr - beginAddr);
-      if (newSeg->permissions & PERM_EXEC) 
-         totalCodeMemory += (endAddr - beginAddr);
-      if (!strcmp(name,appName) && newSeg->permissions & PERM_WRITE) 
-         totalAppDataMemory += (endAddr - beginAddr);
-      if (!strcmp(name,"[heap]") && newSeg->permissions & PERM_WRITE) 
-         totalHeapMemory += (endAddr - beginAddr);
-      if (!strcmp(name,"[stack]") && newSeg->permissions & PERM_WRITE) 
-         totalStackMemory += (endAddr - beginAddr);
+      pending = 1;
+      pendBegin = beginAddr;
+      pendEnd = endAddr;
+      strcpy(pendPerms, perms);
+      strcpy(pendName, name);
    }
+   if (pending)
+      addSegment(pendBegin, pendEnd, pendPerms, pendName, appName, absSize,
+                 rssSize, pageSize, anonHugeSize);
    fclose(f);
    return 0;
 }
 
+/**
+* @brief Add the regions registered by the application to the memory map
+*
+* @details Each region becomes a segment of class 'region' only (so it
+* is not counted twice in the other classes or totals) and is its own
+* stratum. A region is trimmed to whole elements, and one of less than 8
+* bytes (one injected word) is left out, so an injection never leaves
+* the region. The region must lie entirely inside one readable mapping
+* (a stale or bad registration may not), and takes that mapping's
+* permissions and page size, so read-only regions are written the safe
+* way; a region that does not is skipped. The region's bytes are also in
+* the segment that holds them, so a memory type of both, e.g.
+* 'heap|region', weights them twice.
+* @param skipped is set to the number of regions skipped
+* @return number of regions added
+**/
+int addRegionSegments(int *skipped)
+{
+   SdcRegion regions[MAX_REGIONS];
+   MapSegment *newSeg, *seg, *tail = 0;
+   char name[64];
+   char *elemName[] = ELEM_TYPE_NAMES;
+   int i, n, added = 0;
+   size_t elemSize, len;
+   unsigned long begin, end;
+   *skipped = 0;
+   n = snapshotRegions(regions, MAX_REGIONS);
+   for (seg = memoryMap; seg; seg = seg->next)
+      tail = seg;
+   for (i = 0; i < n; i++) {
+      elemSize = (regions[i].elemType == SDC_ELEM_FLOAT ||
+                  regions[i].elemType == SDC_ELEM_INT32) ? 4 : 8;
+      len = regions[i].len - regions[i].len % elemSize;
+      if (len < 8)
+         continue;
+      begin = (unsigned long) regions[i].ptr;
+      end = begin + len;
+      for (seg = memoryMap; seg; seg = seg->next)
+         if (!(seg->memoryClasses & MEM_REGION) && (seg->permissions & PERM_READ) &&
+             seg->mapBegin <= begin && end <= seg->mapEnd)
+            break;
+      if (!seg) {
+         if (sdcDebug)
+            fprintf(stderr, "SDC: region %d (%lx-%lx) not inside one readable "
+                    "mapping, skipped\n", regions[i].id, begin, end);
+         (*skipped)++;
+         continue;
+      }
+      newSeg = (MapSegment*) calloc(1, sizeof(MapSegment));
+      newSeg->beginAddress = newSeg->mapBegin = begin;
+      newSeg->endAddress = newSeg->mapEnd = end;
+      newSeg->permissions = seg->permissions;
+      newSeg->kernelPageSize = seg->kernelPageSize;
+      if (!newSeg->kernelPageSize)
+         newSeg->kernelPageSize = getpagesize();
+      sprintf(name, "[region:%d:%s]", regions[i].id, elemName[regions[i].elemType]);
+      newSeg->name = strdup(name);
+      sprintf(name, "region:[region:%d:%s]", regions[i].id,
+              elemName[regions[i].elemType]);
+      newSeg->stratum = strdup(name);
+      newSeg->stratumId = numStrata++;
+      newSeg->memoryClasses = MEM_REGION;
+      newSeg->elementType = regions[i].elemType;
+      if (tail)
+         tail->next = newSeg;
+      else
+         memoryMap = newSeg;
+      tail = newSeg;
+      totalClassMemory[__builtin_ctz(MEM_REGION)] += len;
+      added++;
+      if (sdcDebug>1)
+         fprintf(stderr, "(%s) (%lx %lx)\n", newSeg->name, newSeg->beginAddress,
+                 newSeg->endAddress);
+   }
+   return added;
+}
+
+/**
+* @brief Find the id of a stratum by name
+* @return stratum id, or -1 if no segment is in the stratum
+**/
+int findStratumId(const char *stratum)
+{
+   MapSegment *seg;
+   for (seg = memoryMap; seg; seg = seg->next)
+      if (!strcmp(seg->stratum, stratum))
+         return seg->stratumId;
+   return -1;
+}
+
+/**
+* @brief Total size of the segments in any of the given memory classes
+*
+* @param classMask is an OR of MEM_* bits
+* @param stratumId limits the total to one stratum, if not -1
+**/
+unsigned long memoryClassSize(unsigned int classMask, int stratumId)
+{
+   MapSegment *seg;
+   unsigned long size = 0;
+   for (seg = memoryMap; seg; seg = seg->next)
+      if ((seg->memoryClasses & classMask) &&
+          (stratumId < 0 || seg->stratumId == stratumId))
+         size += (seg->endAddress - seg->beginAddress);
+   return size;
+}
+
+/**
+* @brief Build the index of segments that can be chosen for injection
+*
+* @param classMask is an OR of MEM_* bits
+* @param stratumId limits the index to one stratum, if not -1
+* @return total size of the indexed segments
+**/
+unsigned long indexMemoryClasses(unsigned int classMask, int stratumId)
+{
+   MapSegment *seg;
+   unsigned long size = 0;
+   selectIndexCount = 0;
+   for (seg = memoryMap; seg; seg = seg->next) {
+      if (!(seg->memoryClasses & classMask) ||
+          (stratumId >= 0 && seg->stratumId != stratumId) ||
+          seg->endAddress == seg->beginAddress)
+         continue;
+      if (selectIndexCount == selectIndexSize) {
+         selectIndexSize = selectIndexSize ? 2*selectIndexSize : 64;
+         selectIndex = realloc(selectIndex, selectIndexSize*sizeof(*selectIndex));
+      }
+      size += (seg->endAddress - seg->beginAddress);
+      selectIndex[selectIndexCount].segment = seg;
+      selectIndex[selectIndexCount].endOffset = size;
+      selectIndexCount++;
+   }
+   return size;
+}
+
+/**
+* @brief Find the indexed segment that an offset into the index falls in
+*
+* @param offset is less than the size returned by indexMemoryClasses()
+* @param segOffset is set to the offset within the segment
+* @return the segment, or null if offset is out of range
+**/
+MapSegment* selectIndexedSegment(unsigned long offset, unsigned long *segOffset)
+{
+   int low = 0, high = selectIndexCount-1, mid;
+   if (selectIndexCount == 0 || offset >= selectIndex[high].endOffset)
+      return 0;
+   // binary search for the first segment ending after offset
+   while (low < high) {
+      mid = (low + high) / 2;
+      if (selectIndex[mid].endOffset > offset)
+         high = mid;
+      else
+         low = mid + 1;
+   }
+   *segOffset = offset - (low ? selectIndex[low-1].endOffset : 0);
+   return selectIndex[low].segment;
+}
+
 /**
 * @brief Dump a human readable view of memory map info to stderr
 **/
 void dumpMemoryMap(int level)
 {
    MapSegment *seg = memoryMap;
+   char *className[] = MEM_CLASS_NAMES;
+   int i;
    while (level > 0 && seg) {
-      fprintf(stderr, "segment: %lx - %lx   %x   (%s)\n", seg->beginAddress, seg->endAddress,
-              seg->permissions, seg->name);
+      fprintf(stderr, "segment: %lx - %lx   %x %4x   %ldk %ldk   (%s)\n", seg->beginAddress,
+              seg->endAddress, seg->permissions, seg->memoryClasses,
+              seg->kernelPageSize/1024, seg->anonHugePages/1024, seg->name);
       seg = seg->next;
    }
    fprintf(stderr, "Total overall memory: %ld bytes (%.2f MB)\n", totalMemory, 
@@ -179,6 +476,9 @@ void dumpMemoryMap(int level)
           ((double) totalHeapMemory) / (1024*1024));
    fprintf(stderr, "Total stack   memory: %ld bytes (%.2f MB)\n", totalStackMemory, 
           ((double) totalStackMemory) / (1024*1024));
+   for (i = 0; i < sizeof(className)/sizeof(char*); i++)
+      fprintf(stderr, "Class %-7s memory: %ld bytes (%.2f MB)\n", className[i],
+              totalClassMemory[i], ((double) totalClassMemory[i]) / (1024*1024));
 }
 
 #ifdef TESTING
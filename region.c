@@ -0,0 +1,162 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Registry of application memory regions to inject
+*
+* @details The application can register its important arrays with
+* sdc_register_region() (see sdcinject.h) and then run with
+* SDC_MEMTYPE=region to inject only into them. The element type of a
+* region lets SDC_BITS name a field (sign, exponent or mantissa) of the
+* elements rather than bits of a 64-bit word.
+*
+* The registry is a fixed array of slots, each guarded by a sequence
+* count that is odd while the slot is being written. A writer takes a
+* slot by a compare-and-swap of its count from even to odd, so there is
+* no registry-wide lock: two threads only wait on each other when they
+* write the same slot, i.e., register or unregister the same pointer, and
+* then the waiter yields. A free slot is claimed without waiting (a slot
+* being written is passed over), so two threads registering the same new
+* pointer at once may both claim one; after its claim each looks for
+* another slot with its pointer and frees the higher of the two, and at
+* least one of them sees the other's claim. The injector thread only
+* reads: it copies a slot and keeps the copy if the count was even and
+* did not change. Registering is a scan of the slots in use plus a few
+* atomic operations, cheap enough to do every timestep.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stddef.h>
+#include <sched.h>
+#include "sdc.h"
+
+extern int sdcDebug;
+
+static struct {
+   volatile unsigned long seq; // odd while the slot is being written
+   void * volatile ptr;        // null if the slot is free
+   size_t len;
+   int elemType;
+} regions[MAX_REGIONS];
+static volatile int regionHighWater = 0; // slots above this were never used
+
+/**
+* @brief Write a slot if it still holds the expected pointer
+*
+* @param expect is the pointer the slot must hold (null for a free slot)
+* @param wait is non-zero to wait for another writer of the slot, or 0
+* to give up if the slot is being written
+* @return 1 if the slot was written, 0 if not
+**/
+static int writeSlot(int i, void *expect, void *ptr, size_t len, int elemType,
+                     int wait)
+{
+   unsigned long seq;
+   for (;;) {
+      seq = regions[i].seq;
+      if (!(seq & 1) && __sync_bool_compare_and_swap(&regions[i].seq, seq, seq+1))
+         break;
+      if (!wait)
+         return 0;
+      sched_yield();
+   }
+   if (regions[i].ptr != expect) {
+      regions[i].seq = seq+2; // nothing written, but the count stays even
+      return 0;
+   }
+   regions[i].ptr = ptr;
+   regions[i].len = len;
+   regions[i].elemType = elemType;
+   __sync_synchronize();
+   regions[i].seq = seq+2;
+   return 1;
+}
+
+/**
+* @brief Register (or update) a region of application memory to inject
+*
+* @param ptr is the start of the region
+* @param len is the size of the region in bytes
+* @param elemType is the SDC_ELEM_* type of the region's elements
+* @return 0 on success, -1 if the registry is full or arguments are bad
+**/
+int sdc_register_region(void *ptr, size_t len, int elemType)
+{
+   int i, j, high;
+   if (!ptr || !len || elemType < 0 || elemType >= SDC_NUM_ELEM_TYPES)
+      return -1;
+   for (;;) {
+      high = regionHighWater;
+      // update an existing registration
+      for (i = 0; i < high; i++)
+         if (regions[i].ptr == ptr && writeSlot(i, ptr, ptr, len, elemType, 1))
+            return 0;
+      // or else claim a free slot, using one more slot if none is free
+      for (i = 0; i < high; i++)
+         if (!regions[i].ptr && writeSlot(i, NULL, ptr, len, elemType, 0))
+            break;
+      if (i < high)
+         break;
+      if (high >= MAX_REGIONS) {
+         if (sdcDebug)
+            fprintf(stderr, "SDC: region registry full, %p not registered\n", ptr);
+         return -1;
+      }
+      __sync_bool_compare_and_swap(&regionHighWater, high, high+1);
+   }
+   // free a duplicate claimed by another thread at the same time, keeping
+   // the lower slot (given our values if it was the other thread's)
+   for (j = 0; j < regionHighWater; j++) {
+      if (j == i || regions[j].ptr != ptr)
+         continue;
+      if (j > i)
+         writeSlot(j, ptr, NULL, 0, 0, 1);
+      else if (writeSlot(i, ptr, NULL, 0, 0, 1)) {
+         i = j;
+         writeSlot(i, ptr, ptr, len, elemType, 1);
+      }
+   }
+   return 0;
+}
+
+/**
+* @brief Remove a region from the registry
+*
+* @param ptr is the start of the region, as registered
+**/
+void sdc_unregister_region(void *ptr)
+{
+   int i;
+   if (!ptr)
+      return;
+   for (i = 0; i < regionHighWater; i++)
+      if (regions[i].ptr == ptr)
+         writeSlot(i, ptr, NULL, 0, 0, 1);
+}
+
+/**
+* @brief Copy the currently registered regions
+*
+* @param out receives up to max regions, each with its slot number as id
+* @return number of regions copied
+* @details A slot being written while it is copied is skipped; the
+* injection then just cannot choose that region this time.
+**/
+int snapshotRegions(SdcRegion *out, int max)
+{
+   int i, n = 0;
+   unsigned long seq;
+   for (i = 0; i < regionHighWater && n < max; i++) {
+      seq = regions[i].seq;
+      __sync_synchronize();
+      out[n].ptr = regions[i].ptr;
+      out[n].len = regions[i].len;
+      out[n].elemType = regions[i].elemType;
+      out[n].id = i;
+      __sync_synchronize();
+      if (!(seq & 1) && seq == regions[i].seq && out[n].ptr)
+         n++;
+   }
+   return n;
+}
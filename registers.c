@@ -0,0 +1,294 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Inject bit errors into application thread registers
+*
+* @details This code injects a bit error into the register state of
+* one application thread. A real-time signal is sent to the chosen
+* thread; the signal handler flips a bit in the general purpose or
+* vector register state saved in the signal's ucontext_t, and when the
+* handler returns the kernel restores the (now corrupted) register state
+* and the thread resumes. Only x86_64 is supported.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <dirent.h>
+#include <time.h>
+#include <errno.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+#include "sdc.h"
+
+extern int sdcDebug;
+
+#ifdef __x86_64__
+
+// general purpose registers that may be injected, indexed by gregs[] slot
+static char* gprName[] = {"R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15",
+                          "RDI", "RSI", "RBP", "RBX", "RDX", "RAX", "RCX", "RSP",
+                          "RIP", "EFLAGS"};
+#define NUM_GPRS (sizeof(gprName)/sizeof(char*))
+
+// EFLAGS bits that sigreturn restores (the kernel's FIX_EFLAGS: CF, PF,
+// AF, ZF, SF, TF, DF, OF, RF, AC); flips of any other bit are dropped
+static int eflagsBit[] = {0, 2, 4, 6, 7, 8, 10, 11, 16, 18};
+#define NUM_EFLAGS_BITS (sizeof(eflagsBit)/sizeof(int))
+
+// layout of the fxsave/xsave area that the kernel puts in the signal frame
+#define FXSAVE_XMM_OFFSET   160         // _xmm[0] in the legacy fxsave area
+#define FXSAVE_SWBYTES      464         // struct _fpx_sw_bytes in reserved area
+#define XSAVE_HEADER_OFFSET 512         // xstate_bv is the first field
+#define XSAVE_YMMH_OFFSET   576         // YMM_Hi128, fixed in standard format
+#define XSTATE_MAGIC1       0x46505853U // FP_XSTATE_MAGIC1
+#define XFEATURE_SSE        (1UL<<1)
+#define XFEATURE_YMM        (1UL<<2)
+#define XFEATURE_ZMM_HI256  (1UL<<6)
+#define XFEATURE_HI16_ZMM   (1UL<<7)
+
+/**
+* @brief State shared between the injector thread and the signal handler
+*
+* The injector thread fills in the random draws and arms the fault;
+* the handler (running on the target thread) picks the register from
+* what is actually saved in its frame, flips the bit and records the
+* before and after value of the 64-bit lane holding the bit.
+**/
+static struct {
+   volatile int armed;
+   int regClass;                 // REGS_GPR and/or REGS_VECTOR
+   unsigned long randomReg;      // random draw for register choice
+   unsigned long randomBit;      // random draw for bit choice
+   int isVector;                 // result: vector (1) or GPR (0)
+   int regNumber;                // result: gregs slot or vector reg number
+   int regWidth;                 // result: register width in bits
+   int bit;                      // result: bit number within register
+   uint64_t oldValue, newValue;  // result: 64-bit lane containing the bit
+} regFault;
+static sem_t regFaultDone;
+static int regHandlerInstalled = 0;
+static unsigned int zmmHi256Offset = 0, hi16ZmmOffset = 0;
+
+/**
+* @brief Find 64-bit lane of a vector register in the saved fp state
+*
+* @details If the xsave component holding the lane is in its init state
+* (its xstate_bv bit is clear) then the saved area is not valid, so the
+* component is zeroed and marked present so that the kernel restores
+* our modified value.
+**/
+static uint64_t* vectorLane(char *fp, unsigned long xfeatures, int reg, int lane)
+{
+   uint64_t *xstateBV = (uint64_t*) (fp + XSAVE_HEADER_OFFSET);
+   unsigned long feature;
+   char *area; unsigned int areaSize;
+   if (reg >= 16) {
+      feature = XFEATURE_HI16_ZMM;
+      area = fp + hi16ZmmOffset; areaSize = 16*64;
+      lane += (reg-16)*8;
+   } else if (lane < 2) {
+      feature = XFEATURE_SSE;
+      area = fp + FXSAVE_XMM_OFFSET; areaSize = 16*16;
+      lane += reg*2;
+   } else if (lane < 4) {
+      feature = XFEATURE_YMM;
+      area = fp + XSAVE_YMMH_OFFSET; areaSize = 16*16;
+      lane += reg*2 - 2;
+   } else {
+      feature = XFEATURE_ZMM_HI256;
+      area = fp + zmmHi256Offset; areaSize = 16*32;
+      lane += reg*4 - 4;
+   }
+   if (xfeatures && !(*xstateBV & feature)) {
+      memset(area, 0, areaSize);
+      *xstateBV |= feature;
+   }
+   return ((uint64_t*) area) + lane;
+}
+
+/**
+* @brief Signal handler that flips a bit in the interrupted register state
+**/
+static void registerFaultHandler(int sig, siginfo_t *info, void *context)
+{
+   ucontext_t *uc = (ucontext_t*) context;
+   char *fp = (char*) uc->uc_mcontext.fpregs;
+   unsigned long xfeatures = 0, numRegs;
+   uint32_t *swBytes;
+   uint64_t *lane;
+   if (!regFault.armed)
+      return;
+   regFault.armed = 0;
+   // find which vector state the kernel saved in this frame
+   regFault.regWidth = 128;
+   numRegs = 0;
+   if (fp && (regFault.regClass & REGS_VECTOR)) {
+      numRegs = 16;
+      swBytes = (uint32_t*) (fp + FXSAVE_SWBYTES);
+      if (swBytes[0] == XSTATE_MAGIC1)
+         xfeatures = *((uint64_t*) (swBytes+2));
+      if (xfeatures & XFEATURE_YMM)
+         regFault.regWidth = 256;
+      if ((xfeatures & (XFEATURE_ZMM_HI256|XFEATURE_HI16_ZMM)) ==
+          (XFEATURE_ZMM_HI256|XFEATURE_HI16_ZMM) && zmmHi256Offset && hi16ZmmOffset) {
+         regFault.regWidth = 512;
+         numRegs = 32;
+      }
+   }
+   if (regFault.regClass & REGS_GPR)
+      numRegs += NUM_GPRS;
+   if (!numRegs) {
+      regFault.regWidth = 0; // nothing injectable in this frame
+      sem_post(&regFaultDone);
+      return;
+   }
+   regFault.regNumber = regFault.randomReg % numRegs;
+   if ((regFault.regClass & REGS_GPR) && regFault.regNumber < NUM_GPRS) {
+      regFault.isVector = 0;
+      regFault.regWidth = 64;
+      regFault.bit = regFault.randomBit % 64;
+      if (regFault.regNumber == REG_EFL)
+         regFault.bit = eflagsBit[regFault.randomBit % NUM_EFLAGS_BITS];
+      lane = (uint64_t*) &uc->uc_mcontext.gregs[regFault.regNumber];
+   } else {
+      if (regFault.regClass & REGS_GPR)
+         regFault.regNumber -= NUM_GPRS;
+      regFault.isVector = 1;
+      regFault.bit = regFault.randomBit % regFault.regWidth;
+      lane = vectorLane(fp, xfeatures, regFault.regNumber, regFault.bit/64);
+   }
+   regFault.oldValue = *lane;
+   *lane ^= (0x1UL << (regFault.bit % 64)); // flip the chosen injection bit
+   regFault.newValue = *lane;
+   sem_post(&regFaultDone);
+}
+
+/**
+* @brief Choose a random application thread, other than the caller
+*
+* @return thread id of the chosen thread, or -1 if none found
+**/
+static pid_t chooseTargetThread(void)
+{
+   DIR *dir;
+   struct dirent *ent;
+   pid_t myTid, tid, chosen = -1;
+   int count = 0;
+   myTid = syscall(SYS_gettid);
+   dir = opendir("/proc/self/task");
+   if (!dir)
+      return -1;
+   // reservoir sample so that we only need one pass over the directory
+   while ((ent = readdir(dir)) != NULL) {
+      tid = atoi(ent->d_name);
+      if (tid <= 0 || tid == myTid)
+         continue;
+      count++;
+      if (random() % count == 0)
+         chosen = tid;
+   }
+   closedir(dir);
+   return chosen;
+}
+
+/**
+* @brief Inject a random bit error into one application thread's registers
+*
+* @param logf is the (open) log file, may be null
+* @param regClass selects REGS_GPR and/or REGS_VECTOR registers
+* @param sigNum is the real-time signal to deliver the fault with
+* @return 0 on success, -1 on failure
+* @details Should be called from the injector thread after random()
+* is seeded. Waits (up to a few seconds) for the target thread to take
+* the signal, then logs the register, bit, and before/after values.
+**/
+int injectRegisterError(FILE *logf, int regClass, int sigNum)
+{
+   struct sigaction sa;
+   struct timespec ts;
+   unsigned int eax, ebx, ecx, edx;
+   pid_t target;
+   if (!regHandlerInstalled) {
+      // find where the AVX-512 state lives in the standard xsave format
+      if (__get_cpuid_count(0xd, 6, &eax, &ebx, &ecx, &edx) && eax)
+         zmmHi256Offset = ebx;
+      if (__get_cpuid_count(0xd, 7, &eax, &ebx, &ecx, &edx) && eax)
+         hi16ZmmOffset = ebx;
+      sem_init(&regFaultDone, 0, 0);
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_sigaction = registerFaultHandler;
+      sa.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigemptyset(&sa.sa_mask);
+      // handler is left installed, so a late signal is harmlessly ignored
+      if (sigaction(sigNum, &sa, NULL)) {
+         if (logf) fprintf(logf, "Register fault: cannot install signal handler\n");
+         return -1;
+      }
+      regHandlerInstalled = 1;
+   }
+   target = chooseTargetThread();
+   if (target < 0) {
+      if (sdcDebug) fprintf(stderr, "SDC: no application thread to inject\n");
+      if (logf) fprintf(logf, "Register fault: no application thread found\n");
+      return -1;
+   }
+   regFault.regClass = regClass;
+   regFault.randomReg = random();
+   regFault.randomBit = random();
+   regFault.armed = 1;
+   if (sdcDebug)
+      fprintf(stderr, "SDC: Injecting register error into thread %d\n", target);
+   if (syscall(SYS_tgkill, getpid(), target, sigNum)) {
+      regFault.armed = 0;
+      if (logf) fprintf(logf, "Register fault: signal to thread %d failed\n", target);
+      return -1;
+   }
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ts.tv_sec += 5;
+   while (sem_timedwait(&regFaultDone, &ts) && errno == EINTR)
+      ;
+   if (regFault.armed) {
+      // thread has the signal blocked or is stuck in the kernel
+      regFault.armed = 0;
+      if (logf) fprintf(logf, "Register fault: thread %d did not take signal\n", target);
+      return -1;
+   }
+   if (!regFault.regWidth) {
+      if (logf) fprintf(logf, "Register fault: no registers of chosen type saved\n");
+      return -1;
+   }
+   if (!logf)
+      return 0;
+   fprintf(logf, "Injected error info:\nThread: %d\n", target);
+   if (regFault.isVector)
+      fprintf(logf, "Register: %cMM%d[%d]\n", regFault.regWidth==512? 'Z' :
+              regFault.regWidth==256? 'Y' : 'X', regFault.regNumber, regFault.bit/64);
+   else
+      fprintf(logf, "Register: %s\n", gprName[regFault.regNumber]);
+   fprintf(logf, "Bit number: %d\nBit mask: %lx\n", regFault.bit,
+           0x1UL << (regFault.bit % 64));
+   fprintf(logf, "Current value: %lx\n", regFault.oldValue);
+   fprintf(logf, "New value: %lx\n", regFault.newValue);
+   return 0;
+}
+
+#else
+
+int injectRegisterError(FILE *logf, int regClass, int sigNum)
+{
+   if (logf) fprintf(logf, "Register fault: not supported on this architecture\n");
+   return -1;
+}
+
+#endif
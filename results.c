@@ -0,0 +1,131 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Campaign result helpers shared by the log analysis tools
+*
+* @details sdcstrata and sdcagg both read injector logs and report
+* failure rates, so the rules they must agree on live here: how a
+* trial's outcome is read from its log, whether it is a failure, and the
+* confidence interval of a rate. A trial's outcome is taken from an
+* "Outcome: word" line, which campaign scripts may append to the log
+* after checking the application's output; "benign" is a success and any
+* other word a failure. Without an Outcome line, a trial whose log has
+* "Application finished" is benign and one without it (the application
+* died) is a failure. Also here is the string-keyed hash table both
+* tools count their groups in.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sdc.h"
+
+/**
+* @brief Find an entry by key, creating it if asked to
+*
+* @param entrySize is the size of the caller's entry type, which has a
+* KeyEntry as its first member; new entries are zeroed
+* @param create is non-zero to add the key if it is not there
+* @return the entry, or null if it is not there and create is 0
+**/
+KeyEntry* findKey(KeyTable *t, const char *key, size_t entrySize, int create)
+{
+   unsigned long h = 5381;
+   const char *p;
+   KeyEntry *e;
+   for (p = key; *p; p++)
+      h = h*33 + *p;
+   h %= KEY_HASH_SIZE;
+   for (e = t->table[h]; e; e = e->next)
+      if (!strcmp(e->key, key))
+         return e;
+   if (!create)
+      return NULL;
+   e = (KeyEntry*) calloc(1, entrySize);
+   e->key = strdup(key);
+   e->next = t->table[h];
+   t->table[h] = e;
+   t->count++;
+   return e;
+}
+
+/**
+* @brief List the entries of a table
+*
+* @param out receives the count entries, in no particular order
+* @return number of entries
+**/
+int listKeys(KeyTable *t, KeyEntry **out)
+{
+   KeyEntry *e;
+   int i, n = 0;
+   for (i = 0; i < KEY_HASH_SIZE; i++)
+      for (e = t->table[i]; e; e = e->next)
+         out[n++] = e;
+   return n;
+}
+
+/**
+* @brief Forget the outcome read so far, for the next trial in a log
+**/
+void clearOutcome(TrialOutcome *o)
+{
+   o->outcome[0] = '\0';
+   o->finished = 0;
+}
+
+/**
+* @brief Note a log line if it tells the trial's outcome
+* @return 1 if it did, 0 if not
+**/
+int scanOutcome(TrialOutcome *o, const char *line)
+{
+   if (sscanf(line, "Outcome: %63s", o->outcome) == 1)
+      return 1;
+   if (!strncmp(line, "Application finished", 20)) {
+      o->finished = 1;
+      return 1;
+   }
+   return 0;
+}
+
+/**
+* @brief Name of the trial's outcome: its Outcome word, or else 'benign'
+* if the application finished and 'died' if not
+**/
+const char* outcomeName(TrialOutcome *o)
+{
+   if (o->outcome[0])
+      return o->outcome;
+   return o->finished ? "benign" : "died";
+}
+
+/**
+* @brief Whether the trial failed, i.e., its outcome is not benign
+**/
+int outcomeFailed(TrialOutcome *o)
+{
+   return strcmp(outcomeName(o), "benign") != 0;
+}
+
+/**
+* @brief Failure rate with its 95% Wilson score interval
+*
+* @param low and high are set to the interval, clipped to 0-1
+* @return the rate, failures/trials
+**/
+double wilsonInterval(unsigned long failures, unsigned long trials, double *low,
+                      double *high)
+{
+   double p, center, halfWidth, denom, z = 1.96;
+   p = (double) failures / trials;
+   denom = 1 + z*z/trials;
+   center = (p + z*z/(2*trials)) / denom;
+   halfWidth = z * sqrt(p*(1-p)/trials + z*z/(4.0*trials*trials)) / denom;
+   *low = center - halfWidth < 0 ? 0 : center - halfWidth;
+   *high = center + halfWidth > 1 ? 1 : center + halfWidth;
+   return p;
+}
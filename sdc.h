@@ -8,6 +8,9 @@
 * Copyright (C) 2021 Jonathan Cook
 *
 **/
+#include <stdint.h>
+#define SDC_LIBRARY_BUILD // export the sdcinject.h API as strong symbols
+#include "sdcinject.h"
 
 #define PERM_READ 0x1
 #define PERM_WRITE 0x2
@@ -15,10 +18,149 @@
 #define PERM_SHARED 0x20
 #define PERM_PRIVATE 0x10
 
+#define REGS_GPR 0x1
+#define REGS_VECTOR 0x2
+
+/* memory class bits, set for each segment when the memory map is read;
+   a memory type (SDC_MEMTYPE) is an OR of these */
+#define MEM_CODE    0x01    // executable
+#define MEM_DATA    0x02    // writable
+#define MEM_RODATA  0x04    // read-only and not executable
+#define MEM_APPDATA 0x08    // writable, in the application image
+#define MEM_HEAP    0x10    // writable [heap]
+#define MEM_STACK   0x20    // writable [stack]
+#define MEM_ANON    0x40    // writable, not file-backed (incl. heap and stack)
+#define MEM_DSO     0x80    // in a shared library
+#define MEM_REGION  0x100   // registered by the application (sdcinject.h)
+#define MEM_DSO_MATCH(i) (0x200 << (i)) // name matches i'th 'dso:' pattern
+#define MEM_ALL     (MEM_CODE|MEM_DATA|MEM_RODATA)
+#define MEM_CLASS_NAMES {"code", "data", "rodata", "appdata", "heap", "stack", \
+                         "anon", "dso", "region"}
+#define NUM_MEM_CLASSES 17
+#define MAX_DSO_PATTERNS 8
+
+typedef enum {injectMEMORY=1, injectREGISTER} InjectMode;
+
+/* element fields SDC_BITS can name instead of a bit range; the bits
+   depend on the element type of the injected memory */
+enum {bitsRANGE, bitsSIGN, bitsEXPONENT, bitsMANTISSA};
+#define BIT_FIELD_NAMES {"range", "sign", "exponent", "mantissa"}
+#define ELEM_TYPE_NAMES {"bytes", "int32", "int64", "float", "double"}
+
+/* likely data types of memory words (see wordtype.c); a word type
+   (SDC_WORDTYPE) is an OR of 1<<WORD_* bits */
+enum {WORD_ZERO, WORD_INT, WORD_POINTER, WORD_FLOAT, WORD_DOUBLE, WORD_OTHER,
+      NUM_WORD_TYPES};
+#define WORD_TYPE_NAMES {"zero", "int", "pointer", "float", "double", "other"}
+
+/* registered application regions (see region.c) */
+#define MAX_REGIONS 256
+typedef struct {
+   void *ptr;
+   size_t len;
+   int elemType;  // SDC_ELEM_* type
+   int id;        // registry slot
+} SdcRegion;
+
+/* ECC models for screening multi-bit error patterns (see ecc.c) */
+typedef enum {eccNONE=0, eccSECDED, eccCHIPKILL} EccModel;
+#define ECC_MODEL_NAMES {"none", "secded", "chipkill"}
+#define MAX_ECC_FLIPS 8
+
+typedef struct {
+   unsigned long candidates; // error patterns screened
+   unsigned long corrected;  // data fixed by the ECC
+   unsigned long detected;   // uncorrectable, machine check (DUE)
+   unsigned long silent;     // undetected or miscorrected
+} EccStats;
+
+/* events that can trigger the injection instead of SDC_DELAY: the MPI
+   calls wrapped in pmpi.c (names and enum must match), then the ids
+   of the sdc_inject_point() calls in the application (see sdcinject.h) */
+#define SDC_MPI_EVENT_NAMES {"MPI_Allreduce", "MPI_Reduce", "MPI_Bcast", \
+   "MPI_Barrier", "MPI_Allgather", "MPI_Alltoall", "MPI_Send", "MPI_Recv", \
+   "MPI_Isend", "MPI_Irecv", "MPI_Sendrecv", "MPI_Wait", "MPI_Waitall"}
+enum {eventMPI_ALLREDUCE, eventMPI_REDUCE, eventMPI_BCAST, eventMPI_BARRIER,
+      eventMPI_ALLGATHER, eventMPI_ALLTOALL, eventMPI_SEND, eventMPI_RECV,
+      eventMPI_ISEND, eventMPI_IRECV, eventMPI_SENDRECV, eventMPI_WAIT,
+      eventMPI_WAITALL, NUM_MPI_EVENTS};
+#define MAX_INJECT_POINTS 64
+#define EVENT_INJECT_POINT(id) (NUM_MPI_EVENTS + (id))
+#define NUM_EVENTS (NUM_MPI_EVENTS + MAX_INJECT_POINTS)
+
+/* per-thread event counts and the count (if any) that fires the trigger,
+   see trigger.c; counting an event is one increment and one compare */
+extern __thread unsigned long sdcEventCount[NUM_EVENTS]
+   __attribute__((tls_model("initial-exec")));
+extern unsigned long sdcTriggerAt[NUM_EVENTS];
+void sdcFireTrigger(void);
+#define SDC_COUNT_EVENT(e) \
+   do { if (__builtin_expect(++sdcEventCount[e] == sdcTriggerAt[e], 0)) \
+           sdcFireTrigger(); } while (0)
+
+/* campaign log results, for the analysis tools (see results.c) */
+#define KEY_HASH_SIZE 1021
+typedef struct key_entry {
+   char *key;
+   struct key_entry *next;
+} KeyEntry;                   // first member of a tool's table entry
+
+typedef struct {
+   KeyEntry *table[KEY_HASH_SIZE];
+   int count;
+} KeyTable;
+
+typedef struct {
+   char outcome[64];          // word of an "Outcome:" line, empty if none
+   int finished;              // "Application finished" was logged
+} TrialOutcome;
+
 typedef struct map_struct {
    unsigned long beginAddress;
    unsigned long endAddress;
+   unsigned long mapBegin;       // whole mapping, before the RSS adjustment
+   unsigned long mapEnd;
    int  permissions;
+   unsigned long kernelPageSize; // bytes, from smaps KernelPageSize
+   unsigned long anonHugePages;  // bytes of segment backed by transparent huge pages
    char *name;
+   char *stratum;                // sampling stratum, "class:name"
+   int stratumId;                // same for all segments in a stratum
+   unsigned int memoryClasses;   // MEM_* bits
+   int elementType;              // SDC_ELEM_* type of a registered region
    struct map_struct *next;
 } MapSegment;
+
+/**
+* Campaign plan file layout (see plan.c). The file is a PlanHeader,
+* then numConfigs PlanEntry records, then one 16-bit slot per
+* (trial,rank) pair holding a 1-based config index (0 = no injection).
+* Slot for a process is trial*numRanks+rank (or just trial if numRanks
+* is 0, i.e., not an MPI campaign). PlanEntry fields that are -1 were
+* not set in the manifest and fall back to the environment/defaults,
+* as do empty strings.
+**/
+#define PLAN_MAGIC "SDCPLAN1"
+
+typedef struct {
+   char magic[8];
+   int32_t numRanks;
+   int32_t numTrials;
+   int32_t numConfigs;
+   int32_t entrySize;
+} PlanHeader;
+
+typedef struct {
+   int32_t delay;
+   int32_t mode;
+   int32_t registerType;
+   int32_t bitLow;
+   int32_t bitHigh;
+   int32_t bitField;
+   int32_t ecc;
+   int32_t flips;
+   char memoryType[64]; // empty if not set
+   char trigger[32];    // empty if not set
+   char wordType[64];   // empty if not set
+   char stratum[160];   // empty if not set
+} PlanEntry;
@@ -0,0 +1,380 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Campaign result aggregator
+*
+* @details Rolls up the injector logs of a campaign into failure rates,
+* with 95% Wilson score intervals, grouped by:
+*  - class: the memory classes of the injected segment (code, data,
+*    rodata, appdata, heap, stack, anon, dso, region), or 'register' for
+*    register injections; a segment has several classes (e.g., the heap
+*    is data, heap and anon), so a trial counts in each of them and the
+*    rows of this table overlap
+*  - object: the DSO or segment name ([heap], [stack], ...), or the register
+*  - symbol: the function or variable hit, if the injector found one
+*  - bit: the (lowest) bit number flipped
+*  - outcome: the outcome word of each trial
+* A trial's outcome and failure are read as results.c defines (shared
+* with sdcstrata), and records that did not inject anything are skipped.
+*
+* Logs are streamed a line at a time, so memory does not grow with the
+* number of trials: each grouping keeps at most a fixed number of keys
+* (-g, default 4096) and counts any further ones under '(other)'. With
+* -j N, N threads take log files off the list and count them separately,
+* merging their tables at the end. With -o FILE, the merged counts are
+* also written as a partial result, which can be given as an input file
+* (it is recognized by its first line) to merge results from many nodes,
+* e.g., 'sdcagg -o node3.agg logs...' on each node and then
+* 'sdcagg node*.agg'. Tables print the -l (default 20) largest groups of
+* each kind, with all the bits that were hit.
+*
+* Usage: sdcagg [-j threads] [-l rows] [-g maxgroups] [-o partialfile] [file...]
+*        (file names are read from stdin if none are given)
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sdc.h"
+
+// routines from results.c
+KeyEntry* findKey(KeyTable *t, const char *key, size_t entrySize, int create);
+int listKeys(KeyTable *t, KeyEntry **out);
+void clearOutcome(TrialOutcome *o);
+int scanOutcome(TrialOutcome *o, const char *line);
+const char* outcomeName(TrialOutcome *o);
+int outcomeFailed(TrialOutcome *o);
+double wilsonInterval(unsigned long failures, unsigned long trials, double *low,
+                      double *high);
+
+#define AGG_MAGIC "SDCAGG1"
+#define OTHER_KEY "(other)"
+
+enum {byCLASS, byOBJECT, bySYMBOL, byBIT, byOUTCOME, NUM_GROUPINGS};
+static char *groupingName[] = {"class", "object", "symbol", "bit", "outcome"};
+
+typedef struct {
+   KeyEntry entry;
+   unsigned long trials;
+   unsigned long failures;
+} Group;
+
+typedef struct {
+   KeyTable grouping[NUM_GROUPINGS];
+   unsigned long trials;
+   unsigned long failures;
+} Tally;
+
+/* the trial being read from a log */
+typedef struct {
+   char key[NUM_GROUPINGS][160]; // class key unused, see classes
+   char classes[160];            // 'data|heap|anon', or 'register'
+   char stratumClass[32];        // for logs without a Memory Classes line
+   int injected;
+   TrialOutcome outcome;
+} Record;
+
+static int maxGroups = 4096;
+static char **fileList;
+static int numFiles = 0, nextFile = 0;
+static pthread_mutex_t fileLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+* @brief Add counts to a group, creating it if there is room
+**/
+static void addToGroup(KeyTable *g, const char *key, unsigned long trials,
+                       unsigned long failures)
+{
+   Group *grp;
+   grp = (Group*) findKey(g, key, sizeof(Group), g->count < maxGroups);
+   if (!grp)
+      // table is full, count it with the other overflow keys
+      grp = (Group*) findKey(g, OTHER_KEY, sizeof(Group), 1);
+   grp->trials += trials;
+   grp->failures += failures;
+}
+
+/**
+* @brief Start a new record
+**/
+static void clearRecord(Record *r)
+{
+   memset(r, 0, sizeof(Record));
+   clearOutcome(&r->outcome);
+}
+
+/**
+* @brief Count a finished record, if it injected an error
+**/
+static void addRecord(Tally *t, Record *r)
+{
+   char *classes, *name, *save;
+   int i, failed;
+   if (r->injected) {
+      strcpy(r->key[byOUTCOME], outcomeName(&r->outcome));
+      failed = outcomeFailed(&r->outcome);
+      for (i = byOBJECT; i < NUM_GROUPINGS; i++)
+         addToGroup(&t->grouping[i], r->key[i][0] ? r->key[i] : "-", 1, failed);
+      // one count in each class of the segment
+      classes = r->classes[0] ? r->classes : r->stratumClass[0] ? r->stratumClass : "-";
+      for (name = strtok_r(classes, "|", &save); name; name = strtok_r(0, "|", &save))
+         addToGroup(&t->grouping[byCLASS], name, 1, failed);
+      t->trials++;
+      t->failures += failed;
+   }
+   clearRecord(r);
+}
+
+/**
+* @brief Copy the first word of s, up to one of the stop characters
+**/
+static void copyWord(char *dst, const char *s, const char *stop, int size)
+{
+   int n = strcspn(s, stop);
+   if (n >= size)
+      n = size-1;
+   memcpy(dst, s, n);
+   dst[n] = '\0';
+}
+
+/**
+* @brief Merge a partial result file (after its first line)
+**/
+static void readPartial(Tally *t, FILE *f, const char *filename)
+{
+   char line[512], kind[16], key[256];
+   unsigned long trials, failures;
+   int i;
+   while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "%15s %lu %lu %255[^\n]", kind, &trials, &failures, key) != 4) {
+         fprintf(stderr, "sdcagg: %s: bad line: %s", filename, line);
+         continue;
+      }
+      if (!strcmp(kind, "total")) {
+         t->trials += trials;
+         t->failures += failures;
+         continue;
+      }
+      for (i = 0; i < NUM_GROUPINGS; i++)
+         if (!strcmp(kind, groupingName[i]))
+            addToGroup(&t->grouping[i], key, trials, failures);
+   }
+}
+
+/**
+* @brief Read the injection records in one log file (or a partial result)
+**/
+static void readLog(Tally *t, const char *filename)
+{
+   FILE *f;
+   char line[512], *p;
+   Record r;
+   int bit;
+   f = fopen(filename, "r");
+   if (!f) {
+      perror(filename);
+      return;
+   }
+   clearRecord(&r);
+   if (!fgets(line, sizeof(line), f)) {
+      fclose(f); // empty log, no trial
+      return;
+   }
+   if (!strncmp(line, AGG_MAGIC, strlen(AGG_MAGIC))) {
+      readPartial(t, f, filename);
+      fclose(f);
+      return;
+   }
+   do {
+      if (!strncmp(line, "SDC Configuration:", 18)) {
+         addRecord(t, &r);
+      } else if (sscanf(line, "Bit number: %d", &bit) == 1) {
+         r.injected = 1;
+         sprintf(r.key[byBIT], "%d", bit);
+      } else if (!strncmp(line, "Memory Classes: ", 16)) {
+         copyWord(r.classes, line+16, " \n", sizeof(r.classes));
+      } else if (!strncmp(line, "Stratum: ", 9)) {
+         copyWord(r.stratumClass, line+9, ":\n", sizeof(r.stratumClass));
+      } else if (!strncmp(line, "Register: ", 10)) {
+         strcpy(r.classes, "register");
+         copyWord(r.key[byOBJECT], line+10, "[\n", sizeof(r.key[byOBJECT]));
+      } else if (!strncmp(line, "Name: ", 6)) {
+         // "Name: /path/libfoo.so (symbol,address)" or "Name: [heap]"
+         p = strstr(line+6, " (");
+         if (p) {
+            copyWord(r.key[bySYMBOL], p+2, ",\n", sizeof(r.key[bySYMBOL]));
+            *p = '\0';
+         }
+         p = line+6;
+         if (*p == '/')
+            p = strrchr(p, '/') + 1;
+         copyWord(r.key[byOBJECT], p, "\n", sizeof(r.key[byOBJECT]));
+      } else
+         scanOutcome(&r.outcome, line);
+   } while (fgets(line, sizeof(line), f) != NULL);
+   addRecord(t, &r);
+   fclose(f);
+}
+
+/**
+* @brief Get the next input file name, or null when there are no more
+**/
+static char* nextFileName(char *buf, int size)
+{
+   char *name = 0;
+   pthread_mutex_lock(&fileLock);
+   if (fileList) {
+      if (nextFile < numFiles)
+         name = fileList[nextFile++];
+   } else if (fscanf(stdin, "%1023s", buf) == 1)
+      name = buf;
+   pthread_mutex_unlock(&fileLock);
+   return name;
+}
+
+/**
+* @brief Thread routine: count log files until there are none left
+**/
+static void* countFiles(void *p)
+{
+   Tally *t = (Tally*) p;
+   char buf[1024], *name;
+   while ((name = nextFileName(buf, sizeof(buf))) != NULL)
+      readLog(t, name);
+   return NULL;
+}
+
+/**
+* @brief Sort groups by decreasing trials (bits by bit number)
+**/
+static int byTrials(const void *a, const void *b)
+{
+   const Group *ga = *(Group**) a, *gb = *(Group**) b;
+   if (ga->trials != gb->trials)
+      return ga->trials < gb->trials ? 1 : -1;
+   return strcmp(ga->entry.key, gb->entry.key);
+}
+
+static int byBitNumber(const void *a, const void *b)
+{
+   const Group *ga = *(Group**) a, *gb = *(Group**) b;
+   return atoi(ga->entry.key) - atoi(gb->entry.key);
+}
+
+/**
+* @brief Print one grouping as a table, with Wilson score intervals
+**/
+static void printGrouping(KeyTable *g, int kind, int rows)
+{
+   Group **groups, *grp;
+   int i, n;
+   double p, lo, hi;
+   if (!g->count)
+      return;
+   groups = (Group**) malloc(g->count * sizeof(Group*));
+   n = listKeys(g, (KeyEntry**) groups);
+   qsort(groups, n, sizeof(Group*), kind == byBIT ? byBitNumber : byTrials);
+   if (kind == byBIT)
+      rows = n;
+   printf("# by %s\n# %8s %8s %10s %10s %10s  %s\n", groupingName[kind], "trials",
+          "failures", "rate", "ci95-low", "ci95-high", groupingName[kind]);
+   for (i = 0; i < n && i < rows; i++) {
+      grp = groups[i];
+      p = wilsonInterval(grp->failures, grp->trials, &lo, &hi);
+      printf("  %8lu %8lu %10.6f %10.6f %10.6f  %s\n", grp->trials, grp->failures, p,
+             lo, hi, grp->entry.key);
+   }
+   if (i < n)
+      printf("# ... %d more\n", n - i);
+   free(groups);
+}
+
+/**
+* @brief Write the counts as a partial result that can be merged later
+**/
+static int writePartial(Tally *t, const char *filename)
+{
+   FILE *f;
+   Group *grp;
+   KeyEntry *e;
+   int i, k;
+   f = fopen(filename, "w");
+   if (!f) {
+      perror(filename);
+      return -1;
+   }
+   fprintf(f, "%s\ntotal %lu %lu -\n", AGG_MAGIC, t->trials, t->failures);
+   for (k = 0; k < NUM_GROUPINGS; k++)
+      for (i = 0; i < KEY_HASH_SIZE; i++)
+         for (e = t->grouping[k].table[i]; e; e = e->next) {
+            grp = (Group*) e;
+            fprintf(f, "%s %lu %lu %s\n", groupingName[k], grp->trials, grp->failures,
+                    grp->entry.key);
+         }
+   return fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+   Tally *tally, *total;
+   pthread_t *threads;
+   Group *grp;
+   KeyEntry *e;
+   char *partialFile = 0;
+   int i, k, h, numThreads = 1, rows = 20;
+   for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+      if (!strcmp(argv[i], "-j") && i+1 < argc)
+         numThreads = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-l") && i+1 < argc)
+         rows = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-g") && i+1 < argc)
+         maxGroups = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-o") && i+1 < argc)
+         partialFile = argv[++i];
+      else
+         break;
+   }
+   if ((i < argc && argv[i][0] == '-' && argv[i][1]) || numThreads < 1 || maxGroups < 1) {
+      fprintf(stderr, "Usage: %s [-j threads] [-l rows] [-g maxgroups] [-o partialfile] "
+              "[file...]\n", argv[0]);
+      return 1;
+   }
+   if (i < argc) {
+      fileList = argv + i;
+      numFiles = argc - i;
+   }
+   // each thread counts into its own tally
+   tally = (Tally*) calloc(numThreads, sizeof(Tally));
+   threads = (pthread_t*) malloc(numThreads * sizeof(pthread_t));
+   for (i = 1; i < numThreads; i++)
+      pthread_create(&threads[i], NULL, countFiles, &tally[i]);
+   countFiles(&tally[0]);
+   for (i = 1; i < numThreads; i++)
+      pthread_join(threads[i], NULL);
+   total = (Tally*) calloc(1, sizeof(Tally));
+   for (i = 0; i < numThreads; i++) {
+      total->trials += tally[i].trials;
+      total->failures += tally[i].failures;
+      for (k = 0; k < NUM_GROUPINGS; k++)
+         for (h = 0; h < KEY_HASH_SIZE; h++)
+            for (e = tally[i].grouping[k].table[h]; e; e = e->next) {
+               grp = (Group*) e;
+               addToGroup(&total->grouping[k], grp->entry.key, grp->trials,
+                          grp->failures);
+            }
+   }
+   if (partialFile && writePartial(total, partialFile))
+      return 1;
+   if (!total->trials) {
+      fprintf(stderr, "sdcagg: no injection records found\n");
+      return 1;
+   }
+   printf("# %lu trials, %lu failures, failure rate %.6f\n", total->trials,
+          total->failures, (double) total->failures / total->trials);
+   for (k = 0; k < NUM_GROUPINGS; k++)
+      printGrouping(&total->grouping[k], k, rows);
+   return 0;
+}
@@ -0,0 +1,57 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Public header for applications that mark injection points
+* and register memory regions
+*
+* @details Put SDC_INJECT_POINT(id) at interesting places in the
+* application (e.g., once per timestep) and run with
+* SDC_TRIGGER=point:id:N to inject the error right before the Nth time
+* the point is reached. Register important arrays with
+* SDC_REGISTER_REGION(ptr, len, type) and run with SDC_MEMTYPE=region to
+* inject only into them; with SDC_BITS=sign, exponent or mantissa the
+* flipped bit is in that field of the element type (see region.c).
+* Re-registering a pointer updates its length and type. The functions
+* are declared weak, so the application still links and runs without
+* the injector library; the macros then do nothing. The library itself
+* defines SDC_LIBRARY_BUILD (in sdc.h) so that its definitions are
+* exported as strong symbols.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#ifndef SDCINJECT_H
+#define SDCINJECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* region element types; bytes are injected as 64-bit words */
+enum {SDC_ELEM_BYTES, SDC_ELEM_INT32, SDC_ELEM_INT64, SDC_ELEM_FLOAT,
+      SDC_ELEM_DOUBLE, SDC_NUM_ELEM_TYPES};
+
+#ifdef SDC_LIBRARY_BUILD
+#define SDC_WEAK
+#else
+#define SDC_WEAK __attribute__((weak))
+#endif
+
+void sdc_inject_point(int id) SDC_WEAK;
+int sdc_register_region(void *ptr, size_t len, int elemType) SDC_WEAK;
+void sdc_unregister_region(void *ptr) SDC_WEAK;
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SDC_INJECT_POINT(id) \
+   do { if (sdc_inject_point) sdc_inject_point(id); } while (0)
+#define SDC_REGISTER_REGION(ptr, len, type) \
+   do { if (sdc_register_region) sdc_register_region(ptr, len, type); } while (0)
+#define SDC_UNREGISTER_REGION(ptr) \
+   do { if (sdc_unregister_region) sdc_unregister_region(ptr); } while (0)
+
+#endif
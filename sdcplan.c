@@ -0,0 +1,380 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Campaign plan compiler
+*
+* @details Compiles a text campaign manifest into the binary plan file
+* that the injector reads through SDC_PLAN. The manifest is line based,
+* with '#' comments:
+*
+*     ranks 64          -- ranks per trial (0 or omitted: not MPI)
+*     trials 1000       -- number of trials in the campaign
+*     trial 0-999 rank * delay=5 memtype=data
+*     trial 7,9 rank 3 memtype=heap|stack bits=52-62
+*     trial 8 rank 0-31 inject=no
+*
+* 'ranks' and 'trials' must come before any 'trial' line. A trial line
+* selects trials and (optionally, default '*') ranks by '*', a number,
+* or comma-separated numbers and LOW-HIGH ranges, and sets keys delay,
+* trigger, memtype, mode, regtype, bits, stratum, wordtype, ecc and flips
+* for each selected process, marking it to be injected; inject=no unmarks
+* it. Later lines override earlier ones, and keys never set fall back to
+* the environment variables at run time. Selecting ranks other than '*'
+* needs a non-zero 'ranks' count, and any malformed line is an error
+* (reported with its line number), so a plan never silently differs from
+* its manifest.
+*
+* Usage: sdcplan manifest planfile
+*        sdcplan -l planfile trial [rank]   (look up and print an entry)
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdc.h"
+
+int sdcDebug = 0;
+
+// routines from plan.c
+unsigned int parseMemoryType(const char *spec, char **patterns, int *numPatterns);
+int parseInjectMode(const char *name);
+int parseRegisterType(const char *name);
+int parseTrigger(const char *spec, unsigned long *count);
+int parseBitRange(const char *range, int *low, int *high);
+int parseBitField(const char *name);
+unsigned int parseWordType(const char *spec);
+int parseEccModel(const char *name);
+int lookupPlanEntry(const char *filename, int trial, int rank, PlanEntry *entry);
+
+#define MAX_CONFIGS 65535
+
+static PlanEntry *configs = 0;
+static int numConfigs = 0;
+static uint16_t *slots = 0;
+static int numRanks = 0, numTrials = 0;
+static int lineNumber = 0;
+
+/**
+* @brief Report a manifest error and quit
+**/
+static void manifestError(const char *msg, const char *token)
+{
+   fprintf(stderr, "sdcplan: line %d: %s (%s)\n", lineNumber, msg, token);
+   exit(1);
+}
+
+/**
+* @brief Parse a whole non-negative decimal (or 0x hex) number
+* @return the number, or -1 if value is not one
+**/
+static long parseCount(const char *value)
+{
+   char *end;
+   long n;
+   n = strtol(value, &end, 0);
+   if (end == value || *end || n < 0 || n > 0x7fffffff)
+      return -1;
+   return n;
+}
+
+/**
+* @brief Allocate memory or quit
+**/
+static void* checkAlloc(void *p)
+{
+   if (!p) {
+      fprintf(stderr, "sdcplan: out of memory\n");
+      exit(1);
+   }
+   return p;
+}
+
+/**
+* @brief Return 1-based index of config, adding it if it is new
+**/
+static uint16_t internConfig(PlanEntry *entry)
+{
+   int i;
+   for (i = 0; i < numConfigs; i++)
+      if (!memcmp(&configs[i], entry, sizeof(PlanEntry)))
+         return i+1;
+   if (numConfigs >= MAX_CONFIGS)
+      manifestError("too many distinct configurations", "");
+   if (!(numConfigs & (numConfigs+1))) // grow at 0,1,3,7,...
+      configs = (PlanEntry*) checkAlloc(realloc(configs,
+                                                2*(numConfigs+1)*sizeof(PlanEntry)));
+   configs[numConfigs] = *entry;
+   return ++numConfigs;
+}
+
+/**
+* @brief Check whether value n is chosen by a selector string
+**/
+static int selected(const char *sel, int n)
+{
+   const char *p = sel;
+   char *end;
+   long lo, hi;
+   if (!strcmp(sel, "*"))
+      return 1;
+   while (*p) {
+      lo = strtol(p, &end, 0);
+      if (end == p)
+         manifestError("bad selector", sel);
+      hi = lo;
+      if (*end == '-') {
+         p = end+1;
+         hi = strtol(p, &end, 0);
+         if (end == p)
+            manifestError("bad selector", sel);
+      }
+      if (n >= lo && n <= hi)
+         return 1;
+      if (*end == ',')
+         end++;
+      else if (*end)
+         manifestError("bad selector", sel);
+      p = end;
+   }
+   return 0;
+}
+
+/**
+* @brief Mark every field of a plan entry as not set
+**/
+static void clearEntry(PlanEntry *entry)
+{
+   memset(entry, 0xff, sizeof(PlanEntry)); // all numbers -1
+   memset(entry->memoryType, 0, sizeof(entry->memoryType));
+   memset(entry->trigger, 0, sizeof(entry->trigger));
+   memset(entry->wordType, 0, sizeof(entry->wordType));
+   memset(entry->stratum, 0, sizeof(entry->stratum));
+}
+
+/**
+* @brief Apply one 'trial' manifest line to every selected slot
+**/
+static void applyLine(char *trialSel, char *rankSel, char **keys, int numKeys)
+{
+   PlanEntry set, merged;
+   int i, trial, rank, inject = 1, lineConfigs;
+   uint16_t *remap, old;
+   unsigned long slot;
+   char *value;
+   int numPatterns = 0;
+   unsigned long count;
+   clearEntry(&set);
+   for (i = 0; i < numKeys; i++) {
+      value = strchr(keys[i], '=');
+      if (!value)
+         manifestError("expected key=value", keys[i]);
+      *value++ = '\0';
+      if (!strcmp(keys[i], "delay")) {
+         if ((set.delay = parseCount(value)) < 0)
+            manifestError("bad delay", value);
+      } else if (!strcmp(keys[i], "memtype")) {
+         if (strlen(value) >= sizeof(set.memoryType) ||
+             !parseMemoryType(value, 0, &numPatterns))
+            manifestError("bad memtype", value);
+         strcpy(set.memoryType, value);
+      } else if (!strcmp(keys[i], "mode")) {
+         if (!(set.mode = parseInjectMode(value)))
+            manifestError("bad mode", value);
+      } else if (!strcmp(keys[i], "regtype")) {
+         if (!(set.registerType = parseRegisterType(value)))
+            manifestError("bad regtype", value);
+      } else if (!strcmp(keys[i], "bits")) {
+         if (!(set.bitField = parseBitField(value))) {
+            set.bitField = -1;
+            if (parseBitRange(value, &set.bitLow, &set.bitHigh))
+               manifestError("bad bits", value);
+         }
+      } else if (!strcmp(keys[i], "trigger")) {
+         if (strlen(value) >= sizeof(set.trigger) || parseTrigger(value, &count) < 0)
+            manifestError("bad trigger", value);
+         strcpy(set.trigger, value);
+      } else if (!strcmp(keys[i], "stratum")) {
+         if (strlen(value) >= sizeof(set.stratum))
+            manifestError("stratum name too long", value);
+         strcpy(set.stratum, value);
+      } else if (!strcmp(keys[i], "wordtype")) {
+         if (strlen(value) >= sizeof(set.wordType) || !parseWordType(value))
+            manifestError("bad wordtype", value);
+         strcpy(set.wordType, value);
+      } else if (!strcmp(keys[i], "ecc")) {
+         if ((set.ecc = parseEccModel(value)) < 0)
+            manifestError("bad ecc", value);
+      } else if (!strcmp(keys[i], "flips")) {
+         set.flips = parseCount(value);
+         if (set.flips < 1 || set.flips > MAX_ECC_FLIPS)
+            manifestError("bad flips", value);
+      } else if (!strcmp(keys[i], "inject")) {
+         inject = strcmp(value, "no") && strcmp(value, "0");
+      } else
+         manifestError("unknown key", keys[i]);
+   }
+   // cache old->new config index so each distinct merge is interned once
+   lineConfigs = numConfigs;
+   remap = (uint16_t*) checkAlloc(calloc(lineConfigs+1, sizeof(uint16_t)));
+   for (trial = 0; trial < numTrials; trial++) {
+      if (!selected(trialSel, trial))
+         continue;
+      for (rank = 0; rank < (numRanks > 0 ? numRanks : 1); rank++) {
+         if (numRanks > 0 && !selected(rankSel, rank))
+            continue;
+         slot = (unsigned long) trial * (numRanks > 0 ? numRanks : 1) + rank;
+         old = slots[slot];
+         if (!inject) {
+            slots[slot] = 0;
+            continue;
+         }
+         if (old <= lineConfigs && remap[old]) {
+            slots[slot] = remap[old];
+            continue;
+         }
+         if (old)
+            merged = configs[old-1];
+         else
+            clearEntry(&merged);
+         if (set.delay != -1) merged.delay = set.delay;
+         if (set.memoryType[0]) strcpy(merged.memoryType, set.memoryType);
+         if (set.trigger[0]) strcpy(merged.trigger, set.trigger);
+         if (set.mode != -1) merged.mode = set.mode;
+         if (set.registerType != -1) merged.registerType = set.registerType;
+         if (set.bitLow != -1) {
+            merged.bitLow = set.bitLow;
+            merged.bitHigh = set.bitHigh;
+            merged.bitField = -1;
+         }
+         if (set.bitField != -1) {
+            merged.bitField = set.bitField;
+            merged.bitLow = merged.bitHigh = -1;
+         }
+         if (set.stratum[0])
+            strcpy(merged.stratum, set.stratum);
+         if (set.wordType[0]) strcpy(merged.wordType, set.wordType);
+         if (set.ecc != -1) merged.ecc = set.ecc;
+         if (set.flips != -1) merged.flips = set.flips;
+         slots[slot] = internConfig(&merged);
+         if (old <= lineConfigs)
+            remap[old] = slots[slot];
+      }
+   }
+   free(remap);
+}
+
+/**
+* @brief Read manifest and write compiled plan file
+**/
+static int compilePlan(FILE *in, FILE *out)
+{
+   char line[1024], *tok[64], *p;
+   int numTok, keyStart;
+   unsigned long numSlots = 0;
+   PlanHeader hdr;
+   while (fgets(line, sizeof(line), in) != NULL) {
+      lineNumber++;
+      if ((p = strchr(line, '#')))
+         *p = '\0';
+      numTok = 0;
+      for (p = strtok(line, " \t\r\n"); p && numTok < 64; p = strtok(0, " \t\r\n"))
+         tok[numTok++] = p;
+      if (numTok == 0)
+         continue;
+      if (!strcmp(tok[0], "ranks") || !strcmp(tok[0], "trials")) {
+         if (slots)
+            manifestError("must come before trial lines", tok[0]);
+         if (numTok != 2 || parseCount(tok[1]) < 0)
+            manifestError("expected one count", tok[0]);
+         if (tok[0][0] == 'r')
+            numRanks = parseCount(tok[1]);
+         else
+            numTrials = parseCount(tok[1]);
+      } else if (!strcmp(tok[0], "trial")) {
+         if (numTok < 2)
+            manifestError("missing trial selector", tok[0]);
+         if (!slots) {
+            if (numTrials <= 0)
+               manifestError("trial count not set", tok[0]);
+            numSlots = (unsigned long) numTrials * (numRanks > 0 ? numRanks : 1);
+            slots = (uint16_t*) checkAlloc(calloc(numSlots, sizeof(uint16_t)));
+         }
+         keyStart = 2;
+         if (numTok > 2 && !strcmp(tok[2], "rank")) {
+            if (numTok < 4)
+               manifestError("missing rank selector", tok[2]);
+            // a rank selector would be ignored, so it must be '*'
+            if (numRanks <= 0 && strcmp(tok[3], "*"))
+               manifestError("rank selector without ranks", tok[3]);
+            keyStart = 4;
+         }
+         applyLine(tok[1], keyStart == 4 ? tok[3] : "*", tok+keyStart, numTok-keyStart);
+      } else
+         manifestError("unknown directive", tok[0]);
+   }
+   if (!slots) {
+      fprintf(stderr, "sdcplan: no trial lines in manifest\n");
+      return 1;
+   }
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, PLAN_MAGIC, sizeof(hdr.magic));
+   hdr.numRanks = numRanks;
+   hdr.numTrials = numTrials;
+   hdr.numConfigs = numConfigs;
+   hdr.entrySize = sizeof(PlanEntry);
+   if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+       fwrite(configs, sizeof(PlanEntry), numConfigs, out) != numConfigs ||
+       fwrite(slots, sizeof(uint16_t), numSlots, out) != numSlots) {
+      perror("sdcplan: write");
+      return 1;
+   }
+   fprintf(stderr, "sdcplan: %d trials x %d ranks, %d configurations\n",
+           numTrials, numRanks, numConfigs);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   FILE *in, *out;
+   PlanEntry entry;
+   int rval;
+   if (argc >= 4 && !strcmp(argv[1], "-l")) {
+      rval = lookupPlanEntry(argv[2], atoi(argv[3]), argc > 4 ? atoi(argv[4]) : -1, &entry);
+      if (rval < 0) {
+         fprintf(stderr, "sdcplan: %s is not a usable plan file\n", argv[2]);
+         return 1;
+      }
+      if (rval == 0)
+         printf("no injection\n");
+      else
+         printf("delay %d trigger %s memtype %s mode %d regtype %d bits %d-%d field %d "
+                "stratum %s wordtype %s ecc %d flips %d\n",
+                entry.delay, entry.trigger[0] ? entry.trigger : "-",
+                entry.memoryType[0] ? entry.memoryType : "-", entry.mode,
+                entry.registerType, entry.bitLow, entry.bitHigh, entry.bitField,
+                entry.stratum[0] ? entry.stratum : "-",
+                entry.wordType[0] ? entry.wordType : "-", entry.ecc, entry.flips);
+      return 0;
+   }
+   if (argc != 3) {
+      fprintf(stderr, "Usage: %s manifest planfile\n", argv[0]);
+      fprintf(stderr, "       %s -l planfile trial [rank]\n", argv[0]);
+      return 1;
+   }
+   in = fopen(argv[1], "r");
+   if (!in) {
+      perror(argv[1]);
+      return 1;
+   }
+   out = fopen(argv[2], "w");
+   if (!out) {
+      perror(argv[2]);
+      return 1;
+   }
+   rval = compilePlan(in, out);
+   fclose(in);
+   fclose(out);
+   return rval;
+}
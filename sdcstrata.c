@@ -0,0 +1,236 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Stratified campaign estimator and adaptive trial planner
+*
+* @details Reads injector log files and groups the memory injections by
+* the stratum logged with each one (segment class plus DSO/segment name,
+* see readsmaps.c). Each log records the stratum's weight, its share of
+* the memory of the chosen type, so per-stratum outcome rates can be
+* re-weighted into an overall estimate whether the trials were drawn
+* uniformly or aimed at strata with SDC_STRATUM. The estimate is unbiased
+* only for the strata seen in the logs, so their coverage of each memory
+* type's weight is printed; when a campaign of one memory type covers less
+* than all of it, bounds for the whole memory are also printed, taking the
+* unseen weight as all benign or all failing.
+*
+* A trial's outcome is read as results.c defines (shared with sdcagg):
+* an "Outcome: word" line, which campaign scripts may append to the log
+* after checking the application's output, or whether the application
+* finished.
+*
+* With -n N, the next N trials are allocated across the strata in
+* proportion to weight times outcome standard deviation (Neyman
+* allocation), shifting trials to the strata that contribute the most
+* variance, and are printed as sdcplan manifest lines starting at trial
+* number -t, for the ranks selected by -k (default '*') out of -r ranks.
+* Every report line starts with '#', so the whole output can be given to
+* sdcplan as the next round's manifest.
+* Each line sets the stratum and the memory type it was injected under
+* (the first one logged for it), since a stratum is only found among the
+* segments of the memory type in effect.
+*
+* Usage: sdcstrata [-n trials] [-t firsttrial] [-r ranks] [-k ranksel] [logfile...]
+*        (log file names are read from stdin if none are given)
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sdc.h"
+
+// routines from results.c
+KeyEntry* findKey(KeyTable *t, const char *key, size_t entrySize, int create);
+int listKeys(KeyTable *t, KeyEntry **out);
+void clearOutcome(TrialOutcome *o);
+int scanOutcome(TrialOutcome *o, const char *line);
+int outcomeFailed(TrialOutcome *o);
+double wilsonInterval(unsigned long failures, unsigned long trials, double *low,
+                      double *high);
+
+typedef struct {
+   KeyEntry entry;            // the stratum name
+   char memoryType[64];       // SDC_MEMTYPE it was first seen under
+   double weightSum;          // sum of logged weights (for the mean)
+   unsigned long trials;
+   unsigned long failures;
+   double allocation;         // planned trials (-n)
+} Stratum;
+
+static KeyTable strataTable;
+
+/**
+* @brief Record one trial's result
+**/
+static void addTrial(const char *stratum, const char *memoryType, double weight,
+                     TrialOutcome *outcome)
+{
+   Stratum *s;
+   if (!stratum[0])
+      return; // not a memory injection, or injection never happened
+   s = (Stratum*) findKey(&strataTable, stratum, sizeof(Stratum), 1);
+   if (!s->memoryType[0])
+      strcpy(s->memoryType, memoryType);
+   s->weightSum += weight;
+   s->trials++;
+   s->failures += outcomeFailed(outcome);
+}
+
+/**
+* @brief Read the injection records in one log file
+**/
+static void readLog(const char *filename)
+{
+   FILE *f;
+   char line[512], stratum[256], memoryType[64];
+   double weight = 0;
+   TrialOutcome outcome;
+   f = fopen(filename, "r");
+   if (!f) {
+      perror(filename);
+      return;
+   }
+   stratum[0] = memoryType[0] = '\0';
+   clearOutcome(&outcome);
+   while (fgets(line, sizeof(line), f) != NULL) {
+      if (!strncmp(line, "SDC Configuration:", 18)) {
+         addTrial(stratum, memoryType, weight, &outcome);
+         stratum[0] = memoryType[0] = '\0';
+         weight = 0;
+         clearOutcome(&outcome);
+      } else if (sscanf(line, "Stratum Weight: %lf", &weight) == 1)
+         ;
+      else if (sscanf(line, "Stratum: %255s", stratum) == 1)
+         ;
+      else if (sscanf(line, "Memory Type: %63s", memoryType) == 1)
+         ;
+      else
+         scanOutcome(&outcome, line);
+   }
+   addTrial(stratum, memoryType, weight, &outcome);
+   fclose(f);
+}
+
+/**
+* @brief Sort strata by decreasing weight
+**/
+static int byWeight(const void *a, const void *b)
+{
+   const Stratum *sa = *(Stratum**) a, *sb = *(Stratum**) b;
+   double wa = sa->weightSum/sa->trials, wb = sb->weightSum/sb->trials;
+   return wa < wb ? 1 : wa > wb ? -1 : strcmp(sa->entry.key, sb->entry.key);
+}
+
+int main(int argc, char **argv)
+{
+   Stratum **strata, *s;
+   char filename[1024];
+   int i, j, numStrata, numTypes = 0, planTrials = 0, firstTrial = 0, ranks = -1, trial;
+   unsigned long totalTrials = 0, failures = 0;
+   double w, p, totalWeight = 0, estimate = 0, variance = 0, z = 1.96;
+   double neymanSum = 0, target, deficitSum = 0, cumulative, lo, hi, coverage;
+   char *rankSel = "*";
+   for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+      if (!strcmp(argv[i], "-n") && i+1 < argc)
+         planTrials = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-t") && i+1 < argc)
+         firstTrial = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-r") && i+1 < argc)
+         ranks = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-k") && i+1 < argc)
+         rankSel = argv[++i];
+      else {
+         fprintf(stderr, "Usage: %s [-n trials] [-t firsttrial] [-r ranks] [-k ranksel] "
+                 "[logfile...]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (i < argc) {
+      for (; i < argc; i++)
+         readLog(argv[i]);
+   } else {
+      while (fscanf(stdin, "%1023s", filename) == 1)
+         readLog(filename);
+   }
+   if (!strataTable.count) {
+      fprintf(stderr, "sdcstrata: no memory injection records found\n");
+      return 1;
+   }
+   strata = (Stratum**) malloc(strataTable.count * sizeof(Stratum*));
+   numStrata = listKeys(&strataTable, (KeyEntry**) strata);
+   qsort(strata, numStrata, sizeof(Stratum*), byWeight);
+   for (i = 0; i < numStrata; i++) {
+      totalWeight += strata[i]->weightSum / strata[i]->trials;
+      totalTrials += strata[i]->trials;
+      failures += strata[i]->failures;
+   }
+   // per-stratum rates with Wilson score intervals
+   printf("# %-10s %8s %8s %10s %10s %10s  %s\n", "weight", "trials", "failures",
+          "rate", "ci95-low", "ci95-high", "stratum");
+   for (i = 0; i < numStrata; i++) {
+      s = strata[i];
+      w = s->weightSum / s->trials / totalWeight;
+      p = wilsonInterval(s->failures, s->trials, &lo, &hi);
+      printf("# %-10.6f %8lu %8lu %10.6f %10.6f %10.6f  %s\n", w, s->trials, s->failures,
+             p, lo, hi, s->entry.key);
+      estimate += w * p;
+      variance += w * w * p * (1-p) / s->trials;
+      // Laplace-smoothed deviation, so unfailed strata still get some trials
+      p = (s->failures + 1.0) / (s->trials + 2.0);
+      neymanSum += w * sqrt(p*(1-p));
+   }
+   printf("# stratified failure rate of the observed strata: %.6f +- %.6f (95%%), "
+          "%lu trials, %lu failures\n", estimate, z*sqrt(variance), totalTrials, failures);
+   printf("# raw (unweighted) failure rate: %.6f\n", (double) failures / totalTrials);
+   // weights are shares of one memory type, so coverage is per memory type
+   for (i = 0; i < numStrata; i++) {
+      for (j = 0; j < i; j++)
+         if (!strcmp(strata[j]->memoryType, strata[i]->memoryType))
+            break;
+      if (j < i)
+         continue;
+      coverage = 0;
+      for (j = i; j < numStrata; j++)
+         if (!strcmp(strata[j]->memoryType, strata[i]->memoryType))
+            coverage += strata[j]->weightSum / strata[j]->trials;
+      if (coverage > 1)
+         coverage = 1;
+      printf("# observed strata cover %.6f of the memory weight of memtype %s\n",
+             coverage, strata[i]->memoryType);
+      numTypes++;
+   }
+   // unseen strata could be anything from all benign to all failing
+   if (numTypes == 1 && coverage < 1)
+      printf("# failure rate of all memory: %.6f to %.6f (unobserved strata all "
+             "benign or all failing)\n", estimate*coverage, estimate*coverage + 1-coverage);
+   if (planTrials <= 0)
+      return 0;
+   // Neyman allocation of the overall total, less the trials already run
+   for (i = 0; i < numStrata; i++) {
+      s = strata[i];
+      w = s->weightSum / s->trials / totalWeight;
+      p = (s->failures + 1.0) / (s->trials + 2.0);
+      target = (totalTrials + planTrials) * w * sqrt(p*(1-p)) / neymanSum;
+      s->allocation = target > s->trials ? target - s->trials : 0;
+      deficitSum += s->allocation;
+   }
+   printf("# next %d trials by Neyman allocation\n", planTrials);
+   if (ranks >= 0)
+      printf("ranks %d\n", ranks);
+   printf("trials %d\n", firstTrial + planTrials);
+   // round cumulative sums so that the allocations add up to planTrials
+   cumulative = 0;
+   for (i = 0; i < numStrata; i++) {
+      s = strata[i];
+      trial = firstTrial + (int) floor(cumulative * planTrials / deficitSum + 0.5);
+      cumulative += s->allocation;
+      j = firstTrial + (int) floor(cumulative * planTrials / deficitSum + 0.5);
+      if (j > trial)
+         printf("trial %d-%d rank %s memtype=%s stratum=%s\n", trial, j-1, rankSel,
+                s->memoryType[0] ? s->memoryType : "all", s->entry.key);
+   }
+   return 0;
+}
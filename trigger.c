@@ -0,0 +1,88 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Event triggers for the bit error injector
+*
+* @details Instead of waiting SDC_DELAY seconds of wall-time, the
+* injection can be triggered by the Nth call of a wrapped MPI function
+* (see pmpi.c) or of an sdc_inject_point() in the application (see
+* sdcinject.h), so that it lands at the same program phase on every run.
+* Each thread counts events in its own thread-local counters, so counting
+* is just an increment and a compare; the thread whose count reaches N
+* first wakes the injector thread and waits for the injection to finish
+* before it continues into the call.
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <semaphore.h>
+#include <errno.h>
+#include "sdc.h"
+
+extern int sdcDebug;
+
+__thread unsigned long sdcEventCount[NUM_EVENTS]
+   __attribute__((tls_model("initial-exec")));
+unsigned long sdcTriggerAt[NUM_EVENTS];
+
+static int triggerArmed = 0;
+static volatile int triggerFired = 0;
+static sem_t triggerSem, injectionDoneSem;
+
+/**
+* @brief Set the event and count that triggers the injection
+**/
+void armTrigger(int event, unsigned long count)
+{
+   sem_init(&triggerSem, 0, 0);
+   sem_init(&injectionDoneSem, 0, 0);
+   triggerArmed = 1;
+   sdcTriggerAt[event] = count;
+}
+
+/**
+* @brief Called (once) by the application thread whose event count hit
+* the trigger count; waits until the injection is done
+**/
+void sdcFireTrigger(void)
+{
+   if (!triggerArmed || !__sync_bool_compare_and_swap(&triggerFired, 0, 1))
+      return;
+   if (sdcDebug)
+      fprintf(stderr, "SDC: injection event triggered\n");
+   sem_post(&triggerSem);
+   while (sem_wait(&injectionDoneSem) && errno == EINTR)
+      ;
+}
+
+/**
+* @brief Injector thread waits here until the trigger event happens
+**/
+void waitForTrigger(void)
+{
+   while (sem_wait(&triggerSem) && errno == EINTR)
+      ;
+}
+
+/**
+* @brief Injector thread signals that the injection is done, letting
+* the triggering thread continue
+**/
+void triggerDone(void)
+{
+   if (triggerFired)
+      sem_post(&injectionDoneSem);
+}
+
+/**
+* @brief Application-visible injection point
+*
+* @param id is the point id (0 to MAX_INJECT_POINTS-1), triggers with
+* SDC_TRIGGER=point:id:N
+**/
+void sdc_inject_point(int id)
+{
+   if ((unsigned int) id < MAX_INJECT_POINTS)
+      SDC_COUNT_EVENT(EVENT_INJECT_POINT(id));
+}
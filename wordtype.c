@@ -0,0 +1,222 @@
+/**
+* @file
+* @author Jonathan Cook
+* @brief Guess the type of the data in memory words
+*
+* @details To aim errors at one kind of data (SDC_WORDTYPE), the
+* injector classifies the page around each candidate word and rejects
+* candidates until one of the requested type is found. Each 64-bit word
+* is labelled by heuristics:
+*  - zero: all bits zero
+*  - int: a small (|value| < 2^20) signed integer
+*  - pointer: within the span of the process's mapped memory
+*  - double: a plausible double exponent (|value| about 1e-60 to 1e60)
+*  - float: two 32-bit halves that are each zero or have a plausible
+*    float exponent (|value| about 1e-18 to 1e18), the low one non-zero
+*  - other: none of these (strings, bit fields, hashes, ...)
+* in that order of precedence. Most doubles near 1 also pass the float
+* test (their high half always does, their low half often), so a word
+* that passes both is only a float if its neighbours say so: most of the
+* words around it must pass the float test and few be doubles only,
+* which a run of computed doubles almost never does. Zeros between
+* floating-point or integer words of one type are usually elements of
+* the same array, so such a run of zeros takes that type. The heuristics are branch-free and
+* written with vector extensions, four words at a time (with an AVX2
+* clone picked at load time where the CPU has it), so a 4 KB page takes
+* a few microseconds at most; the last page's labels are kept, so
+* repeated candidates in one page are nearly free. It can be compiled
+* into a stand-alone test and benchmark using -DTESTING
+*
+* Copyright (C) 2021 Jonathan Cook
+*
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "sdc.h"
+
+#define SMALLINT_LIMIT (1L << 20)
+#define DOUBLE_EXP_SPAN 200   // exponents within 1023 +/- this
+#define FLOAT_EXP_SPAN 60     // exponents within 127 +/- this
+#define MAX_PAGE_WORDS 8192   // largest page classified (64 KB)
+#define VOTE_SPAN 4           // neighbours on each side that vote float or double
+
+typedef uint64_t v4u __attribute__((vector_size(32)));
+typedef int64_t v4i __attribute__((vector_size(32)));
+
+static uintptr_t cachedPage = 0;
+static uint8_t cachedTypes[MAX_PAGE_WORDS];
+
+/**
+* @brief Label words with their likely types
+*
+* @param words is the data, n a multiple of 4 words, at most MAX_PAGE_WORDS
+* @param ptrLow and ptrHigh bound the values taken to be pointers
+* @param types receives a WORD_* type for each word
+**/
+__attribute__((target_clones("avx2", "default")))
+void classifyWords(const uint64_t *words, int n, uint64_t ptrLow, uint64_t ptrHigh,
+                   uint8_t *types)
+{
+   v4u w, lo, hi, elo, ehi;
+   v4i isZero, isInt, isPtr, isDouble, isFloat, t, e;
+   uint8_t evidence[MAX_PAGE_WORDS]; // bit 0: float-like, bit 1: double-like
+   int i, j, prev, run, floats, doubles;
+   for (i = 0; i + 4 <= n; i += 4) {
+      memcpy(&w, words+i, sizeof(w));
+      isZero = (w == 0);
+      isInt = (w + SMALLINT_LIMIT) < 2*SMALLINT_LIMIT;
+      isPtr = (w >= ptrLow) & (w < ptrHigh);
+      isDouble = (((w >> 52) & 0x7ff) - (1023-DOUBLE_EXP_SPAN)) <= 2*DOUBLE_EXP_SPAN;
+      lo = w & 0xffffffff;
+      hi = w >> 32;
+      elo = ((lo >> 23) & 0xff) - (127-FLOAT_EXP_SPAN);
+      ehi = ((hi >> 23) & 0xff) - (127-FLOAT_EXP_SPAN);
+      isFloat = (lo != 0) & (elo <= 2*FLOAT_EXP_SPAN) &
+                ((hi == 0) | (ehi <= 2*FLOAT_EXP_SPAN));
+      // lowest precedence first, each test overriding the ones before
+      t = (v4i) {} + WORD_OTHER;
+      t = (t & ~isFloat) | (isFloat & WORD_FLOAT);
+      t = (t & ~isDouble) | (isDouble & WORD_DOUBLE);
+      t = (t & ~isPtr) | (isPtr & WORD_POINTER);
+      t = (t & ~isInt) | (isInt & WORD_INT);
+      t = (t & ~isZero) | (isZero & WORD_ZERO);
+      e = ((isFloat & 1) | (isDouble & 2)) & ~(isPtr | isInt | isZero);
+      for (j = 0; j < 4; j++) {
+         types[i+j] = t[j];
+         evidence[i+j] = e[j];
+      }
+   }
+   // a word that may be a double or two floats is a float if most of its
+   // neighbours are float-like and few are doubles only; floats and
+   // doubles count the float-like and double-only words of the window
+   // (the word itself is float-like, so its own vote is taken off)
+   floats = doubles = 0;
+   for (i = 0; i < n && i < VOTE_SPAN; i++) {
+      floats += evidence[i] & 1;
+      doubles += evidence[i] == 2;
+   }
+   for (i = 0; i < n; i++) {
+      if (i + VOTE_SPAN < n) {
+         floats += evidence[i+VOTE_SPAN] & 1;
+         doubles += evidence[i+VOTE_SPAN] == 2;
+      }
+      if (evidence[i] == 3 && floats-1 > 4*doubles)
+         types[i] = WORD_FLOAT;
+      if (i - VOTE_SPAN >= 0) {
+         floats -= evidence[i-VOTE_SPAN] & 1;
+         doubles -= evidence[i-VOTE_SPAN] == 2;
+      }
+   }
+   // zeros inside an array take the array's type
+   prev = WORD_OTHER;
+   for (i = 0, run = 0; i < n; i++) {
+      if (types[i] == WORD_ZERO) {
+         run++;
+         continue;
+      }
+      if (run && types[i] == prev &&
+          (prev == WORD_DOUBLE || prev == WORD_FLOAT || prev == WORD_INT))
+         memset(types+i-run, prev, run);
+      prev = types[i];
+      run = 0;
+   }
+}
+
+/**
+* @brief Find the likely type of a word, classifying its page
+*
+* @param ptr is the (8-byte aligned) word, in a readable page
+* @param ptrLow and ptrHigh bound the values taken to be pointers
+* @return WORD_* type
+**/
+int wordTypeAt(const uint64_t *ptr, uint64_t ptrLow, uint64_t ptrHigh)
+{
+   static unsigned long pageSize = 0;
+   uintptr_t page;
+   if (!pageSize) {
+      pageSize = getpagesize();
+      if (pageSize > MAX_PAGE_WORDS*sizeof(uint64_t))
+         pageSize = MAX_PAGE_WORDS*sizeof(uint64_t);
+   }
+   page = ((uintptr_t) ptr) & ~(pageSize-1);
+   if (page != cachedPage) {
+      classifyWords((const uint64_t *) page, pageSize/sizeof(uint64_t), ptrLow,
+                    ptrHigh, cachedTypes);
+      cachedPage = page;
+   }
+   return cachedTypes[(((uintptr_t) ptr) - page) / sizeof(uint64_t)];
+}
+
+/**
+* @brief Forget the classified page, e.g., when the memory may have changed
+**/
+void clearWordTypeCache(void)
+{
+   cachedPage = 0;
+}
+
+#ifdef TESTING
+#include <time.h>
+#include <math.h>
+int main(int argc, char **argv)
+{
+   static uint64_t page[5][512] __attribute__((aligned(4096)));
+   char *typeName[] = WORD_TYPE_NAMES;
+   char *pageName[] = {"double", "float", "int", "pointer", "computed"};
+   // each page's expected type, and how many of its words must have it
+   int expected[5] = {WORD_DOUBLE, WORD_FLOAT, WORD_INT, WORD_POINTER, WORD_DOUBLE};
+   int minCount[5] = {510, 511, 512, 512, 500};
+   uint8_t types[512];
+   int i, j, k, count[NUM_WORD_TYPES], failures = 0;
+   double *d = (double *) page[0];
+   float *f = (float *) page[1];
+   long *l = (long *) page[2];
+   void **p = (void **) page[3];
+   double *c = (double *) page[4]; // full mantissas, as computed values have
+   struct timespec t0, t1;
+   for (i = 0; i < 512; i++) {
+      d[i] = (i % 7) ? 1.5e3 * i - 2e4 : 0.0;
+      f[2*i] = 0.25f * i + 1;
+      f[2*i+1] = -3.0f * i;
+      l[i] = i * 37 - 5000;
+      p[i] = malloc(16);
+      c[i] = sin(i * 0.37) * 100 + i / 3.0;
+   }
+   for (k = 0; k < 5; k++) {
+      classifyWords(page[k], 512, 0x10000, 0x800000000000UL, types);
+      memset(count, 0, sizeof(count));
+      for (i = 0; i < 512; i++)
+         count[types[i]]++;
+      fprintf(stderr, "%-8s page:", pageName[k]);
+      for (j = 0; j < NUM_WORD_TYPES; j++)
+         fprintf(stderr, " %s %d", typeName[j], count[j]);
+      fprintf(stderr, "\n");
+      if (count[expected[k]] < minCount[k]) {
+         fprintf(stderr, "  expected at least %d %s words\n", minCount[k],
+                 typeName[expected[k]]);
+         failures++;
+      }
+   }
+   // a zero page stays zero, with no neighbours to take a type from
+   memset(page[0], 0, sizeof(page[0]));
+   classifyWords(page[0], 512, 0x10000, 0x800000000000UL, types);
+   for (i = 0; i < 512 && types[i] == WORD_ZERO; i++)
+      ;
+   fprintf(stderr, "zero     page: %d zero words\n", i);
+   if (i < 512) {
+      fprintf(stderr, "  expected 512 zero words\n");
+      failures++;
+   }
+   fprintf(stderr, "Word type classification: %d failures\n", failures);
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < 100000; i++)
+      classifyWords(page[i%5], 512, 0x10000, 0x800000000000UL, types);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   fprintf(stderr, "%.1f ns per 4 KB page\n",
+           ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 100000);
+   return failures ? 1 : 0;
+}
+#endif